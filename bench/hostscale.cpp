@@ -0,0 +1,222 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * hostscale.cpp
+ *
+ *  Session host scaling benchmark
+ *  usage: hostscale [max parsers [busy [quiet [MiB per busy session]]]]
+ *  Hosts a skewed mix of sessions: a few busy ones flooding their
+ *  terminal with a build log, and many quiet ones printing a line
+ *  every 10 ms, with 1, 2, 4... parsers up to max parsers (by default
+ *  the number of CPUs it may run on). Each run is a fresh process; the
+ *  table has the busy sessions' throughput and the queue latency of
+ *  the quiet ones, from the host's reports.
+ *
+ */
+
+#include "../src/sessionhost.h"
+
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+
+static size_t const QUIET_LINES = 200;
+static int const QUIET_INTERVAL_MS = 10;
+
+
+/* busy session: write mib MiB of build log */
+static int flood(size_t mib)
+{
+    std::string log;
+    for (int i = 0; log.size() < 65536; ++i)
+    {
+        char line[80];
+        snprintf(
+            line,
+            sizeof(line),
+            "[%4d/9999] g++ -c src/module%03d.cpp -o obj/module%03d.o\r\n",
+            i,
+            i % 1000,
+            i % 1000);
+        log += line;
+    }
+
+    for (size_t left = mib << 20; left > 0;)
+    {
+        size_t const n = std::min(left, log.size());
+        if (write(STDOUT_FILENO, log.data(), n) != (ssize_t)n)
+        {
+            return EXIT_FAILURE;
+        }
+        left -= n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/* quiet session: a short line every QUIET_INTERVAL_MS */
+static int trickle(void)
+{
+    for (size_t i = 0; i < QUIET_LINES; ++i)
+    {
+        printf("line %zu\r\n", i);
+        fflush(stdout);
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(QUIET_INTERVAL_MS));
+    }
+    return EXIT_SUCCESS;
+}
+
+/* host the sessions with the given number of parsers, the host's
+ * reports go to stdout */
+static void host(
+    std::string const &self,
+    size_t parsers,
+    size_t busy,
+    size_t quiet,
+    std::string const &mib)
+{
+    char *const busy_argv[] =
+    {
+        (char *)self.c_str(), (char *)"--flood", (char *)mib.c_str(),
+        nullptr
+    };
+    char *const quiet_argv[] =
+    {
+        (char *)self.c_str(), (char *)"--trickle", nullptr
+    };
+
+    SessionHost host{parsers};
+    for (size_t i = 0; i < busy + quiet; ++i)
+    {
+        bool const is_busy = (i < busy);
+        if (!host.spawn(
+                is_busy? busy_argv : quiet_argv,
+                80,
+                24,
+                is_busy? Session::BATCH : Session::INTERACTIVE))
+        {
+            perror("spawn");
+            exit(EXIT_FAILURE);
+        }
+    }
+    host.run(std::chrono::seconds(1));
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "--flood") == 0)
+    {
+        return flood(strtoul(argv[2], nullptr, 0));
+    }
+    if (argc == 2 && strcmp(argv[1], "--trickle") == 0)
+    {
+        return trickle();
+    }
+
+    cpu_set_t cpus;
+    size_t const usable =\
+        (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+        ? CPU_COUNT(&cpus)
+        : 1;
+    size_t const max_parsers = (argc > 1)
+                ? strtoul(argv[1], nullptr, 0)
+                : usable,
+                 busy = (argc > 2)? strtoul(argv[2], nullptr, 0) : 4,
+                 quiet = (argc > 3)? strtoul(argv[3], nullptr, 0) : 60;
+    std::string const mib = (argc > 4)? argv[4] : "64";
+
+    char self[4096];
+    ssize_t const self_size = readlink("/proc/self/exe", self, sizeof(self));
+    if (self_size <= 0 || (size_t)self_size >= sizeof(self))
+    {
+        perror("readlink(/proc/self/exe)");
+        return EXIT_FAILURE;
+    }
+
+    printf(
+        "%zu busy sessions writing %s MiB each, %zu quiet ones, %zu CPUs\n"
+        "parsers      wall     MiB/s   quiet latency mean      max\n",
+        busy,
+        mib.c_str(),
+        quiet,
+        usable);
+    fflush(stdout);
+
+    for (size_t parsers = 1; parsers <= max_parsers; parsers *= 2)
+    {
+        int report[2];
+        if (pipe(report) == -1)
+        {
+            perror("pipe");
+            return EXIT_FAILURE;
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        pid_t const pid = fork();
+        if (pid == -1)
+        {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0)
+        {
+            close(report[0]);
+            dup2(report[1], STDOUT_FILENO);
+            close(report[1]);
+            host(std::string(self, self_size), parsers, busy, quiet, mib);
+            exit(EXIT_SUCCESS);
+        }
+        close(report[1]);
+
+        /* the quiet sessions' latency over all the reports */
+        FILE *in = fdopen(report[0], "r");
+        char line[512];
+        double total_us = 0,
+               max_us = 0;
+        unsigned long long turns = 0;
+        while (fgets(line, sizeof(line), in) != nullptr)
+        {
+            size_t count;
+            unsigned long long n;
+            double mean, max;
+            if (sscanf(
+                    line,
+                    "host: %zu interactive, %llu turns, "
+                    "queue latency %lf us mean, %lf us max",
+                    &count,
+                    &n,
+                    &mean,
+                    &max) == 4)
+            {
+                turns += n;
+                total_us += n * mean;
+                max_us = std::max(max_us, max);
+            }
+        }
+        fclose(in);
+        waitpid(pid, nullptr, 0);
+
+        double const wall = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        printf(
+            "%7zu %8.2f s %9.1f %15.2f ms %8.2f ms\n",
+            parsers,
+            wall,
+            busy * strtod(mib.c_str(), nullptr) / wall,
+            turns == 0? 0.0 : total_us / turns / 1e3,
+            max_us / 1e3);
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * keys.cpp
+ *
+ *  Keypress benchmark
+ *  usage: keys [presses]
+ *  Times keyboard_input over a cycle of letters, digits, cursor, PF and
+ *  keypad keys, some shifted, with local echo off (SRM set) and on,
+ *  and prints the best of a few runs. It only uses what the terminal
+ *  has had from the start, so it builds against older trees to compare
+ *  with.
+ *
+ */
+
+#include "../src/vt102.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+
+
+static int const REPEATS = 6;
+
+static VT102::Key const keys[] =
+{
+    VT102::KB_A, VT102::Up, VT102::KB_Z, VT102::PF1,
+    VT102::KP_5, VT102::Space, VT102::Left, VT102::KB_1,
+};
+static size_t const key_count = sizeof(keys) / sizeof(*keys);
+
+
+/* best time per press, in ns */
+static double press(size_t presses, bool echo)
+{
+    double best = 1e9;
+    for (int i = 0; i < REPEATS; ++i)
+    {
+        VT102 term{};
+        term.SRM = !echo;
+        auto const start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < presses; ++n)
+        {
+            term.keyboard_input(
+                keys[n % key_count],
+                (n & 16)? VT102::Shift : 0);
+            /* sent to the host */
+            if (n % 1024 == 0)
+            {
+                term.outbuffer.clear();
+            }
+        }
+        best = std::min(
+            best,
+            std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count()
+            / presses);
+    }
+    return best;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    size_t const presses =\
+        (argc > 1)? strtoul(argv[1], nullptr, 0) : 2000000;
+
+    /* echoed keys which ring the bell print */
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    int const null = open("/dev/null", O_WRONLY);
+    if (    out == nullptr
+        ||  null == -1
+        ||  dup2(null, STDOUT_FILENO) == -1
+        ||  dup2(null, STDERR_FILENO) == -1)
+    {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "%zu presses, best of %d\n", presses, REPEATS);
+    for (bool echo : {false, true})
+    {
+        fprintf(
+            out,
+            "%-12s %8.1f ns/key\n",
+            echo? "local echo" : "no echo",
+            press(presses, echo));
+        fflush(out);
+    }
+    return EXIT_SUCCESS;
+}
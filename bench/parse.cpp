@@ -0,0 +1,109 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * parse.cpp
+ *
+ *  Parser benchmark on random binary input
+ *  usage: parse [MiB [seed [scrollback lines]]]
+ *  Feeds random bytes to a terminal through interpret_bytes in 4 KiB
+ *  chunks, as the reader thread does, once uniformly random and once
+ *  with one byte in four an ESC, and prints the best of a few runs.
+ *  The scrollback is one line by default, so indexing the history
+ *  doesn't drown out the parser.
+ *  What the terminal prints itself (errors, BEL) is thrown away.
+ *  It only uses what the terminal has had from the start, so it builds
+ *  against older trees to compare with.
+ *
+ */
+
+#include "../src/vt102.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+
+static size_t const CHUNK = 4096;
+static int const REPEATS = 3;
+
+
+static double parse(std::vector<uint8_t> const &input, size_t history)
+{
+    double best = 1e9;
+    for (int i = 0; i < REPEATS; ++i)
+    {
+        VT102 term{};
+        term.scrollback.set_capacity(history);
+        auto const start = std::chrono::steady_clock::now();
+        for (size_t at = 0; at < input.size(); at += CHUNK)
+        {
+            term.interpret_bytes(
+                input.data() + at,
+                std::min(CHUNK, input.size() - at));
+            /* replies to the host */
+            term.outbuffer.clear();
+        }
+        best = std::min(
+            best,
+            std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    size_t const size = ((argc > 1)? strtoul(argv[1], nullptr, 0) : 8) << 20;
+    std::mt19937 random((argc > 2)? strtoul(argv[2], nullptr, 0) : 1);
+    size_t const history = (argc > 3)? strtoul(argv[3], nullptr, 0) : 1;
+
+    std::vector<uint8_t> uniform(size),
+                         escapes(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        uniform[i] = random();
+        escapes[i] = (random() % 4 == 0)? '\033' : random();
+    }
+
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    int const null = open("/dev/null", O_WRONLY);
+    if (    out == nullptr
+        ||  null == -1
+        ||  dup2(null, STDOUT_FILENO) == -1
+        ||  dup2(null, STDERR_FILENO) == -1)
+    {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(
+        out,
+        "%zu MiB in %zu byte chunks, %zu lines of scrollback, "
+        "best of %d\n",
+        size >> 20,
+        CHUNK,
+        history,
+        REPEATS);
+    char const *const names[] = {"uniform random", "one in four ESC"};
+    std::vector<uint8_t> const *const inputs[] = {&uniform, &escapes};
+    for (int i = 0; i < 2; ++i)
+    {
+        double const time = parse(*inputs[i], history);
+        fprintf(
+            out,
+            "%-16s %8.3f s %8.1f MiB/s\n",
+            names[i],
+            time,
+            (size >> 20) / time);
+        fflush(out);
+    }
+    return EXIT_SUCCESS;
+}
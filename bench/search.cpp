@@ -0,0 +1,142 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * search.cpp
+ *
+ *  Scrollback search benchmark
+ *  usage: search [lines [ring [spill path]]]
+ *  Pushes lines of a build log into a scrollback with a ring of the
+ *  given size, spilling the rest to spill path if one is given, then
+ *  times searches for a rare string, a common one, and one too short
+ *  for the index.
+ *
+ */
+
+#include "../src/scrollback.h"
+#include "../src/vt102.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+static int const REPEATS = 5;
+
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static void set_text(Line *line, char const *text)
+{
+    size_t x = 0;
+    for (; text[x] != '\0' && x < line->chars.size(); ++x)
+    {
+        line->chars[x].ch = text[x];
+        line->chars[x].glyph =\
+            VT102::fontidx(CharSet::UnitedStates, text[x]);
+    }
+    for (; x < line->chars.size(); ++x)
+    {
+        line->chars[x].ch = ' ';
+        line->chars[x].glyph =\
+            VT102::fontidx(CharSet::UnitedStates, ' ');
+    }
+}
+
+/* best of REPEATS searches for needle */
+static void time_search(
+    Scrollback const &scrollback,
+    char const *what,
+    std::string const &needle,
+    size_t max_hits)
+{
+    std::vector<Scrollback::Hit> hits;
+    double best = 1e9;
+    for (int i = 0; i < REPEATS; ++i)
+    {
+        hits.clear();
+        auto const start = std::chrono::steady_clock::now();
+        scrollback.search(needle, true, max_hits, &hits);
+        best = std::min(best, seconds_since(start));
+    }
+    printf(
+        "%-8s %-28s %8.3f ms, %zu hits\n",
+        what,
+        ("\"" + needle + "\"").c_str(),
+        best * 1e3,
+        hits.size());
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    size_t const lines = (argc > 1)? strtoul(argv[1], nullptr, 0)
+                                   : 2000000,
+                 ring = (argc > 2)? strtoul(argv[2], nullptr, 0)
+                                  : Scrollback::default_capacity;
+
+    Scrollback scrollback(ring);
+    if (argc > 3 && !scrollback.spill_to(argv[3]))
+    {
+        perror(argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    /* a build log, with an error every 100000 lines */
+    Char const blank =\
+    {
+        ' ', false, false, false, false, CharSet::UnitedStates,
+        (uint8_t)VT102::fontidx(CharSet::UnitedStates, ' ')
+    };
+    Line line{Line::NORMAL, std::vector<Char>(80, blank)};
+    double elapsed = 0;
+    for (size_t i = 0; i < lines; ++i)
+    {
+        char text[81];
+        if (i % 100000 == 99999)
+        {
+            snprintf(
+                text,
+                sizeof(text),
+                "src/module%03zu.cpp:%zu: error: disk quota exceeded",
+                i % 1000,
+                i);
+        }
+        else
+        {
+            snprintf(
+                text,
+                sizeof(text),
+                "[%7zu] g++ -c src/module%03zu.cpp -o obj/module%03zu.o",
+                i,
+                i % 1000,
+                i % 1000);
+        }
+        set_text(&line, text);
+
+        auto const start = std::chrono::steady_clock::now();
+        scrollback.push(line);
+        elapsed += seconds_since(start);
+    }
+
+    printf(
+        "%zu lines (%zu in the ring, %zu spilled), %.2f us/line to push\n"
+        "%.1f MiB resident\n",
+        scrollback.size(),
+        scrollback.capacity(),
+        scrollback.spilled_lines(),
+        elapsed * 1e6 / lines,
+        scrollback.memory_usage() / 1048576.0);
+
+    time_search(scrollback, "rare", "quota exceeded", 1000);
+    time_search(scrollback, "common", "module123.cpp", 1000);
+    time_search(scrollback, "absent", "segmentation fault", 1000);
+    time_search(scrollback, "short", "qx", 1000);
+    return EXIT_SUCCESS;
+}
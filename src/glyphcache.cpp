@@ -0,0 +1,312 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * glyphcache.cpp
+ *
+ *  Shared glyph surfaces
+ *
+ */
+
+#include "glyphcache.h"
+#include "loadfont.h"
+#include "metrics.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+
+static char const *const font_filenames[6] =\
+{
+    "font/80col-normal.pbm",
+    "font/132col-normal.pbm",
+    "font/80col-doublewidth.pbm",
+    "font/132col-doublewidth.pbm",
+    "font/80col-doubleheight.pbm",
+    "font/132col-doubleheight.pbm",
+};
+
+static Uint8 const colour_bold_red = 255,
+                   colour_bold_grn = 255,
+                   colour_bold_blu = 255;
+static Uint8 const colour_red = colour_bold_red * 0.75,
+                   colour_grn = colour_bold_grn * 0.75,
+                   colour_blu = colour_bold_blu * 0.75;
+
+/* SET-UP changes the brightness in tenths */
+static int const brightness_steps = 10;
+
+
+/* the glyph pixels, shared by the caches for every brightness */
+struct GlyphCache::Bitmaps
+{
+    struct Glyph
+    {
+        int w,
+            h;
+        std::unique_ptr<uint8_t[]> pixels;
+    };
+
+    Glyph glyphs[6][128];
+    size_t bytes;
+};
+
+
+/* the live caches, a cache goes away when the last renderer
+ * using it lets go */
+static std::mutex registry_lock;
+static std::map<int, std::weak_ptr<GlyphCache const>> registry;
+std::weak_ptr<GlyphCache::Bitmaps const> GlyphCache::shared_bitmaps;
+
+
+
+/* get the appropriate palette */
+static std::array<SDL_Color, 2> get_palette(
+    double brightness,
+    bool inverted,
+    bool bold)
+{
+    SDL_Color const colours[2] =\
+    {
+        /* background */
+        (SDL_Color)
+        {
+            .r =   0,
+            .g =   0,
+            .b =   0,
+            .a = 255
+        },
+        /* foreground */
+        (SDL_Color)
+        {
+            .r = (Uint8)(
+                (bold? colour_bold_red : colour_red) * brightness),
+            .g = (Uint8)(
+                (bold? colour_bold_grn : colour_grn) * brightness),
+            .b = (Uint8)(
+                (bold? colour_bold_blu : colour_blu) * brightness),
+            .a = 255
+        }
+    };
+
+    std::array<SDL_Color, 2> palette;
+    /* background */
+    palette[0] = colours[inverted? 1 : 0];
+    /* foreground */
+    palette[1] = colours[inverted? 0 : 1];
+
+    return palette;
+}
+
+
+int GlyphCache::step(double brightness)
+{
+    int step = lround(brightness * brightness_steps);
+    return (step < 1)
+        ? 1
+        : (step > brightness_steps)? brightness_steps : step;
+}
+
+std::shared_ptr<GlyphCache const> GlyphCache::get(double brightness)
+{
+    int const key = step(brightness);
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+    std::shared_ptr<GlyphCache const> cache = registry[key].lock();
+    if (cache == nullptr)
+    {
+        metrics.glyph_cache_misses.fetch_add(1, std::memory_order_relaxed);
+        cache.reset(new GlyphCache(key, get_bitmaps()));
+        registry[key] = cache;
+    }
+    else
+    {
+        metrics.glyph_cache_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    return cache;
+}
+
+/* load the font images, or share the ones already loaded,
+ * registry_lock must be held */
+std::shared_ptr<GlyphCache::Bitmaps const> GlyphCache::get_bitmaps(void)
+{
+    std::shared_ptr<Bitmaps const> bitmaps = shared_bitmaps.lock();
+    if (bitmaps != nullptr)
+    {
+        return bitmaps;
+    }
+
+    std::shared_ptr<Bitmaps> loaded(new Bitmaps{});
+    loaded->bytes = sizeof(*loaded);
+    for (size_t i = 0; i < 6; ++i)
+    {
+        FILE *img = fopen(font_filenames[i], "r");
+        if (img == nullptr)
+        {
+            throw std::runtime_error(
+                "fopen(\"" + std::string(font_filenames[i]) + "\"): "
+                + strerror(errno));
+        }
+        Font font_image = read_font(img);
+        fclose(img);
+
+        for (size_t j = 0; j < font_image.size(); ++j)
+        {
+            Image const &in = font_image[j];
+            Bitmaps::Glyph &glyph = loaded->glyphs[i][j];
+            glyph.w = in.width;
+            glyph.h = in.height;
+            glyph.pixels.reset(new uint8_t[in.width * in.height]);
+            for (size_t y = 0; y < in.height; ++y)
+            {
+                for (size_t x = 0; x < in.width; ++x)
+                {
+                    glyph.pixels[(y * in.width) + x] = !in.get(x, y);
+                }
+            }
+            loaded->bytes += in.width * in.height;
+        }
+    }
+
+    shared_bitmaps = loaded;
+    return loaded;
+}
+
+size_t GlyphCache::memory_usage(void)
+{
+    std::lock_guard<std::mutex> guard(registry_lock);
+
+    size_t total = 0;
+    for (auto const &entry : registry)
+    {
+        std::shared_ptr<GlyphCache const> cache = entry.second.lock();
+        if (cache != nullptr)
+        {
+            total += cache->own_memory_usage();
+        }
+    }
+
+    std::shared_ptr<Bitmaps const> bitmaps = shared_bitmaps.lock();
+    if (bitmaps != nullptr)
+    {
+        total += bitmaps->bytes;
+    }
+    return total;
+}
+
+/* the cache itself, not counting the shared bitmaps */
+size_t GlyphCache::own_memory_usage(void) const
+{
+    /* each surface has its own header and pixel format, but the pixels
+     * and palettes are shared */
+    return sizeof(*this)
+         + (6 * variants * 128)
+            * (sizeof(SDL_Surface) + sizeof(SDL_PixelFormat))
+         + variants * (sizeof(SDL_Palette) + 2 * sizeof(SDL_Color));
+}
+
+SurfaceFont const &GlyphCache::font(
+    FontType type,
+    bool use_132_columns,
+    int variant) const
+{
+    switch (type)
+    {
+    case FontType::Normal:
+        return fonts[0 + use_132_columns][variant];
+        break;
+    case FontType::DoubleWide:
+        return fonts[2 + use_132_columns][variant];
+        break;
+    case FontType::DoubleHigh:
+        return fonts[4 + use_132_columns][variant];
+        break;
+    }
+    /* should never happen */
+    throw std::runtime_error("something funky happened!");
+}
+
+std::array<SDL_Color, 2> const &GlyphCache::palette(int variant) const
+{
+    return colours[variant];
+}
+
+
+
+GlyphCache::GlyphCache(int step, std::shared_ptr<Bitmaps const> bitmaps)
+:   brightness_step(step),
+    bitmaps(bitmaps),
+    colours(),
+    palettes(),
+    fonts()
+{
+    double const brightness = (double)step / brightness_steps;
+    for (int v = 0; v < variants; ++v)
+    {
+        colours[v] = get_palette(brightness, v & INVERTED, v & BOLD);
+
+        palettes[v] = SDL_AllocPalette(2);
+        if (palettes[v] == nullptr)
+        {
+            throw std::runtime_error(
+                "failed to alloc palette "
+                + std::string(SDL_GetError()));
+        }
+        if (SDL_SetPaletteColors(palettes[v], colours[v].data(), 0, 2) < 0)
+        {
+            throw std::runtime_error(
+                "failed to set palette colours "
+                + std::string(SDL_GetError()));
+        }
+    }
+
+    /* every colouring of a glyph points at the same pixels */
+    for (size_t i = 0; i < 6; ++i)
+    {
+        for (int v = 0; v < variants; ++v)
+        {
+            for (size_t j = 0; j < fonts[i][v].size(); ++j)
+            {
+                Bitmaps::Glyph const &glyph = bitmaps->glyphs[i][j];
+                SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom(
+                    glyph.pixels.get(),
+                    glyph.w, glyph.h,
+                    8,
+                    glyph.w,
+                    SDL_PIXELFORMAT_INDEX8);
+                if (    surf == nullptr
+                    ||  SDL_SetSurfacePalette(surf, palettes[v]) < 0)
+                {
+                    throw std::runtime_error(
+                        "failed to create glyph surface "
+                        + std::string(SDL_GetError()));
+                }
+                fonts[i][v][j] = surf;
+            }
+        }
+    }
+}
+
+GlyphCache::~GlyphCache()
+{
+    for (size_t i = 0; i < 6; ++i)
+    {
+        for (int v = 0; v < variants; ++v)
+        {
+            for (SDL_Surface *s : fonts[i][v])
+            {
+                SDL_FreeSurface(s);
+            }
+        }
+    }
+    for (SDL_Palette *palette : palettes)
+    {
+        SDL_FreePalette(palette);
+    }
+}
+
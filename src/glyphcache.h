@@ -0,0 +1,98 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * glyphcache.h
+ *
+ *  Shared, pre-coloured glyph surfaces.
+ *  One cache is kept per brightness step, and shared by every
+ *  terminal drawn at that brightness. A cache never changes once
+ *  it's made, so it can be used from any number of renderers.
+ *
+ */
+
+#ifndef _GLYPHCACHE_H
+#define _GLYPHCACHE_H
+
+
+#include <SDL2/SDL.h>
+
+#include <cstddef>
+
+#include <array>
+#include <memory>
+
+
+typedef std::array<SDL_Surface *, 128> SurfaceFont;
+
+enum class FontType
+{
+    Normal,
+    DoubleWide,
+    DoubleHigh,
+};
+
+
+class GlyphCache
+{
+public:
+    /* the glyph colourings, bold and inverted as bit flags */
+    enum Variant
+    {
+        PLAIN = 0,
+        BOLD = 1,
+        INVERTED = 2,
+        BOLD_INVERTED = BOLD | INVERTED,
+    };
+    static constexpr int variants = 4;
+
+    static constexpr int variant(bool bold, bool inverted)
+    {
+        return (bold? BOLD : 0) | (inverted? INVERTED : 0);
+    }
+
+    /* the brightness step a cache is kept for */
+    static int step(double brightness);
+
+    /* get the cache for a brightness, loading it if nobody else
+     * is using it */
+    static std::shared_ptr<GlyphCache const> get(double brightness);
+
+    /* bytes used by all the caches currently alive, including the
+     * glyph bitmaps they share */
+    static size_t memory_usage(void);
+
+    int const brightness_step;
+
+    /* the glyphs of a font in one colouring */
+    SurfaceFont const &font(
+        FontType type,
+        bool use_132_columns,
+        int variant) const;
+
+    /* background and foreground colours of a colouring */
+    std::array<SDL_Color, 2> const &palette(int variant) const;
+
+
+    GlyphCache(GlyphCache const &other) = delete;
+    GlyphCache &operator=(GlyphCache const &other) = delete;
+    ~GlyphCache();
+
+private:
+    struct Bitmaps;
+
+    std::shared_ptr<Bitmaps const> bitmaps;
+    std::array<std::array<SDL_Color, 2>, variants> colours;
+    SDL_Palette *palettes[variants];
+    /* [font file][variant] */
+    SurfaceFont fonts[6][variants];
+
+    /* the bitmaps, while any cache is using them */
+    static std::weak_ptr<Bitmaps const> shared_bitmaps;
+    static std::shared_ptr<Bitmaps const> get_bitmaps(void);
+    size_t own_memory_usage(void) const;
+
+    GlyphCache(int step, std::shared_ptr<Bitmaps const> bitmaps);
+};
+
+
+#endif
+
@@ -0,0 +1,102 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * inqueue.cpp
+ *
+ *  Bounded input from the host
+ *
+ */
+
+#include "inqueue.h"
+#include "metrics.h"
+
+#include <algorithm>
+
+
+
+size_t InQueue::size() const
+{
+    return ring.size();
+}
+
+size_t InQueue::wait_for_space(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (ring.size() >= high_water && !closed)
+    {
+        auto start = std::chrono::steady_clock::now();
+        stats.backpressure_episodes++;
+
+        waiting = true;
+        drained.wait(
+            guard,
+            [this]{ return ring.size() < high_water || closed; });
+        waiting = false;
+
+        auto const waited = std::chrono::steady_clock::now() - start;
+        stats.backpressure_time += waited;
+        metrics.backpressure_ns.fetch_add(
+            std::chrono::nanoseconds(waited).count(),
+            std::memory_order_relaxed);
+    }
+
+    return closed? 0 : high_water - ring.size();
+}
+
+size_t InQueue::write(char const *data, size_t size)
+{
+    size_t n = ring.write(data, size);
+    stats.bytes_in += n;
+    stats.queued_peak = std::max(stats.queued_peak, ring.size());
+    return n;
+}
+
+size_t InQueue::read(char *out, size_t size)
+{
+    size_t n = ring.read(out, size);
+
+    /* let the reader go again; waiting is only looked at under the
+     * lock, so a reader which has just found the ring full is either
+     * seen here or sees the space itself before it sleeps */
+    if (n != 0)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (waiting && ring.size() < high_water)
+        {
+            drained.notify_one();
+        }
+    }
+    return n;
+}
+
+bool InQueue::arm(void)
+{
+    return !notified.exchange(true);
+}
+
+void InQueue::disarm(void)
+{
+    notified.store(false);
+}
+
+void InQueue::close(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    drained.notify_one();
+}
+
+
+
+InQueue::InQueue(size_t i_high_water)
+:   ring(),
+    high_water(std::min(std::max(i_high_water, (size_t)1), capacity)),
+    lock(),
+    drained(),
+    closed(false),
+    waiting(false),
+    notified(false),
+    stats{0, 0, 0, std::chrono::nanoseconds(0)}
+{
+}
+
@@ -0,0 +1,78 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * inqueue.h
+ *
+ *  Bounded queue of bytes read from the host, waiting to be parsed.
+ *  When the queue reaches its high-water mark the reader stops
+ *  reading, so the kernel's pty buffer fills up and the host blocks.
+ *
+ */
+
+#ifndef _INQUEUE_H
+#define _INQUEUE_H
+
+
+#include "ringbuffer.h"
+
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+class InQueue
+{
+    RingBuffer<65536> ring;
+    size_t high_water;
+
+    std::mutex lock;
+    std::condition_variable drained;
+    bool closed,
+         /* the reader is waiting in wait_for_space */
+         waiting;
+
+    /* set while a wakeup is pending for the parser */
+    std::atomic<bool> notified;
+
+public:
+    static constexpr size_t capacity = decltype(ring)::capacity;
+
+    struct Stats
+    {
+        unsigned long long bytes_in,
+                           backpressure_episodes;
+        size_t queued_peak;
+        /* time the reader spent waiting for the parser */
+        std::chrono::nanoseconds backpressure_time;
+    } stats;
+
+    /* number of bytes waiting to be parsed */
+    size_t size() const;
+
+    /* reader: wait until the queue is below its high-water mark,
+     * returns how many bytes can be written, or 0 once closed */
+    size_t wait_for_space(void);
+
+    /* reader: queue bytes read from the host */
+    size_t write(char const *data, size_t size);
+
+    /* parser: take up to size bytes from the queue */
+    size_t read(char *out, size_t size);
+
+    /* returns true if the caller should wake the parser, false if
+     * a wakeup is already pending */
+    bool arm(void);
+
+    /* parser: the pending wakeup has been received */
+    void disarm(void);
+
+    /* wake the reader up for good */
+    void close(void);
+
+
+    InQueue(size_t high_water);
+};
+
+
+#endif
+
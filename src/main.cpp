@@ -10,11 +10,17 @@
  *  rc file?
  */
 
-/* for posix_openpt, ptsname, grantpt and unlockpt */
-#define _XOPEN_SOURCE   600
-
 #include "vt102.h"
-#include "loadfont.h"
+#include "glyphcache.h"
+#include "outqueue.h"
+#include "parsestats.h"
+#include "inqueue.h"
+#include "metrics.h"
+#include "player.h"
+#include "pty.h"
+#include "recorder.h"
+#include "sessionhost.h"
+#include "trace.h"
 
 #include <SDL2/SDL.h>
 #include <sys/ioctl.h>
@@ -23,6 +29,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
 
 #include <cstdlib>
@@ -30,37 +37,23 @@
 #include <cctype>
 #include <cstring>
 #include <cstdio>
+#include <cerrno>
 
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <stdexcept>
-#include <unordered_map>
-
-
 
-typedef std::array<SDL_Surface *, 128> SurfaceFont;
-
-std::string font_filenames[6] =\
-{
-    "font/80col-normal.pbm",
-    "font/132col-normal.pbm",
-    "font/80col-doublewidth.pbm",
-    "font/132col-doublewidth.pbm",
-    "font/80col-doubleheight.pbm",
-    "font/132col-doubleheight.pbm",
-};
 
-SurfaceFont fonts[6];
 
-enum class FontType
+static constexpr struct
 {
-    Normal,
-    DoubleWide,
-    DoubleHigh,
-};
-
-
-std::unordered_map<SDL_Keycode, VT102::Key> const keymap =\
+    SDL_Keycode sym;
+    VT102::Key key;
+} key_bindings[] =\
 {
     /* SDL keycode  VT102 Key */
     { SDLK_F1,          VT102::Key::SetUp       },
@@ -154,12 +147,46 @@ std::unordered_map<SDL_Keycode, VT102::Key> const keymap =\
     { SDLK_KP_PERIOD,   VT102::Key::KP_Period   },
 };
 
-Uint8 colour_bold_red = 255,
-      colour_bold_grn = 255,
-      colour_bold_blu = 255;
-Uint8 colour_red = colour_bold_red * 0.75,
-      colour_grn = colour_bold_grn * 0.75,
-      colour_blu = colour_bold_blu * 0.75;
+/* key_bindings indexed by keycode, -1 for unbound keys: the printable
+ * keycodes are their ASCII characters, and come first, the rest are
+ * scancodes with SDLK_SCANCODE_MASK set */
+static size_t const KEY_TABLE_SIZE = 128 + SDL_NUM_SCANCODES;
+static_assert(VT102::keys <= 127, "VT102::Key doesn't fit in key_table");
+
+static constexpr size_t key_index(SDL_Keycode sym)
+{
+    if (sym >= 0 && sym < 128)
+    {
+        return sym;
+    }
+    if (    (sym & SDLK_SCANCODE_MASK)
+        &&  (sym & ~SDLK_SCANCODE_MASK) < SDL_NUM_SCANCODES)
+    {
+        return 128 + (sym & ~SDLK_SCANCODE_MASK);
+    }
+    return KEY_TABLE_SIZE;
+}
+
+static constexpr auto key_table = []()
+{
+    std::array<signed char, KEY_TABLE_SIZE> table{};
+    for (signed char &key : table)
+    {
+        key = -1;
+    }
+    for (auto const &binding : key_bindings)
+    {
+        table[key_index(binding.sym)] = binding.key;
+    }
+    return table;
+}();
+
+/* the VT102 key bound to sym, or -1 */
+static int bound_key(SDL_Keycode sym)
+{
+    size_t const idx = key_index(sym);
+    return (idx < KEY_TABLE_SIZE)? key_table[idx] : -1;
+}
 
 
 
@@ -202,12 +229,40 @@ Uint32 callback_timer_60hz(Uint32 interval, void *param)
     return interval;
 }
 
+/* data for the fd read thread */
+struct MasterMonitor
+{
+    int fd;
+    InQueue *queue;
+    /* nullptr when not recording */
+    Recorder *recorder;
+};
+
+/* wake up the main thread to parse queued input */
+void push_input_event(void)
+{
+    SDL_UserEvent userevent;
+    userevent.type = SDL_USEREVENT;
+    userevent.code = 1;
+    userevent.data1 = nullptr;
+    userevent.data2 = nullptr;
+
+    SDL_Event event;
+    event.type = SDL_USEREVENT;
+    event.user = userevent;
+
+    SDL_PushEvent(&event);
+}
+
 /* fd read thread callback */
 int thread_monitor_master_fd(void *data)
 {
     int code = EXIT_SUCCESS;
 
-    int fd = *((int *)data);
+    MasterMonitor *monitor = (MasterMonitor *)data;
+    int fd = monitor->fd;
+    InQueue *queue = monitor->queue;
+    Recorder *recorder = monitor->recorder;
 
     struct pollfd fds{};
     fds.fd = fd;
@@ -215,9 +270,22 @@ int thread_monitor_master_fd(void *data)
 
     for (bool done = false; !done;)
     {
-        char ch = 0;
+        char buf[4096];
+
+        /* backpressure: while the parser is behind, stop reading, so
+         * the pty fills up and the host blocks */
+        size_t space = queue->wait_for_space();
+        if (space == 0)
+        {
+            break;
+        }
 
         int nfds = poll(&fds, 1, -1);
+        /* the SIGUSR1/SIGUSR2 dump handlers can interrupt the wait */
+        if (nfds == -1 && errno == EINTR)
+        {
+            continue;
+        }
         if (nfds == -1 || nfds == 0)
         {
             perror("poll");
@@ -226,12 +294,23 @@ int thread_monitor_master_fd(void *data)
             break;
         }
 
-        ssize_t bytesread = read(fd, &ch, sizeof(ch));
+        ssize_t bytesread = read(
+            fd,
+            buf,
+            std::min(sizeof(buf), space));
         if (bytesread == -1)
         {
             int errno_backup = errno;
+            /* the fd is non-blocking, so poll can wake us spuriously,
+             * and a signal can interrupt the read */
+            if (    errno_backup == EAGAIN
+                ||  errno_backup == EWOULDBLOCK
+                ||  errno_backup == EINTR)
+            {
+                continue;
+            }
             /* child process quit */
-            if (errno_backup == EIO)
+            else if (errno_backup == EIO)
             {
                 done = true;
             }
@@ -247,18 +326,19 @@ int thread_monitor_master_fd(void *data)
         {
             done = true;
         }
-
-        SDL_UserEvent userevent;
-        userevent.type = SDL_USEREVENT;
-        userevent.code = 1;
-        userevent.data1 = (void *)new char(ch);
-        userevent.data2 = nullptr;
-
-        SDL_Event event;
-        event.type = SDL_USEREVENT;
-        event.user = userevent;
-
-        SDL_PushEvent(&event);
+        else
+        {
+            /* recorded straight from the read buffer */
+            if (recorder != nullptr)
+            {
+                recorder->output(buf, bytesread);
+            }
+            queue->write(buf, bytesread);
+            if (queue->arm())
+            {
+                push_input_event();
+            }
+        }
     }
 
     /* tell the main thread that we're done */
@@ -277,213 +357,729 @@ int thread_monitor_master_fd(void *data)
     return code;
 }
 
-
-/* get the appropriate font */
-SurfaceFont get_font(FontType type, bool use_132_columns)
-{
-    switch (type)
-    {
-    case FontType::Normal:
-        return fonts[0 + use_132_columns];
-        break;
-    case FontType::DoubleWide:
-        return fonts[2 + use_132_columns];
-        break;
-    case FontType::DoubleHigh:
-        return fonts[4 + use_132_columns];
-        break;
-    }
-    /* should never happen */
-    throw std::runtime_error("something funky happened!");
-}
-
-/* get the appropriate palette */
-std::unique_ptr<SDL_Color[]> get_palette(
-    double brightness,
-    bool inverted,
-    bool bold)
+/* save a snapshot of the terminal's state to path, replacing it
+ * atomically so a crash can't leave a half-written checkpoint, returns
+ * false on error */
+bool write_checkpoint(std::string const &snapshot, std::string const &path)
 {
-    SDL_Color const colours[2] =\
-    {
-        /* background */
-        (SDL_Color)
-        {
-            .r =   0,
-            .g =   0,
-            .b =   0,
-            .a = 255
-        },
-        /* foreground */
-        (SDL_Color)
-        {
-            .r = (Uint8)(
-                (bold? colour_bold_red : colour_red) * brightness),
-            .g = (Uint8)(
-                (bold? colour_bold_grn : colour_grn) * brightness),
-            .b = (Uint8)(
-                (bold? colour_bold_blu : colour_blu) * brightness),
-            .a = 255
-        }
-    };
-
-    std::unique_ptr<SDL_Color[]> palette(new SDL_Color[2]);
-    /* background */
-    palette[0] = colours[inverted? 1 : 0];
-    /* foreground */
-    palette[1] = colours[inverted? 0 : 1];
-
-    return palette;
+    std::string const tmp = path + ".tmp";
+    int fd = open(
+        tmp.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0600);
+    if (fd == -1)
+    {
+        perror(("open(\"" + tmp + "\")").c_str());
+        return false;
+    }
+    for (size_t done = 0; done < snapshot.size();)
+    {
+        ssize_t written = write(
+            fd,
+            snapshot.data() + done,
+            snapshot.size() - done);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror(("write(\"" + tmp + "\")").c_str());
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        done += written;
+    }
+    bool const synced = (fsync(fd) == 0);
+    if (    close(fd) == -1
+        ||  !synced
+        ||  rename(tmp.c_str(), path.c_str()) == -1)
+    {
+        perror(("save \"" + path + "\"").c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
 }
 
-/* convert an Image to an SDL_Surface */
-SDL_Surface *image_to_surface(Image in)
+/* writes checkpoints on a thread of its own, so the render thread
+ * only pays for the snapshot, not the write and fsync; a snapshot still
+ * waiting when the next one is saved is replaced by it */
+class CheckpointWriter
 {
-    SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormat(
-        0,
-        in.width, in.height,
-        8,
-        SDL_PIXELFORMAT_INDEX8);
-
-    memset(surf->pixels, 0, surf->pitch * surf->h);
+    std::string path;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::string pending;
+    bool has_pending,
+         stopping;
+    std::thread thread;
+
+    void run(void)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            wake.wait(guard, [this]() { return has_pending || stopping; });
+            if (!has_pending)
+            {
+                break;
+            }
+            std::string snapshot;
+            snapshot.swap(pending);
+            has_pending = false;
+            guard.unlock();
+            write_checkpoint(snapshot, path);
+            guard.lock();
+        }
+    }
 
-    for (size_t y = 0; y < in.height; ++y)
+public:
+    /* snapshot term, to be written to path */
+    void save(VT102 const &term)
     {
-        for (size_t x = 0; x < in.width; ++x)
+        std::string snapshot;
+        term.serialize(&snapshot);
         {
-            ((uint8_t *)surf->pixels)[(y * surf->pitch) + x] =\
-                !in.get(x, y);
+            std::lock_guard<std::mutex> guard(lock);
+            pending.swap(snapshot);
+            has_pending = true;
         }
+        wake.notify_one();
     }
 
-    SDL_FreePalette(surf->format->palette);
+    /* write the last snapshot saved, and stop */
+    void stop(void)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
 
-    surf->format->palette = SDL_AllocPalette(2);
-    if (surf->format->palette == nullptr)
+    CheckpointWriter(std::string const &checkpoint_path)
+    :   path(checkpoint_path),
+        lock(),
+        wake(),
+        pending(),
+        has_pending(false),
+        stopping(false),
+        thread([this]() { run(); })
     {
-        throw std::runtime_error(
-            "failed to alloc palette "
-            + std::string(SDL_GetError()));
     }
+    ~CheckpointWriter()
+    {
+        stop();
+    }
+};
 
-    if (SDL_SetPaletteColors(
-            surf->format->palette,
-            get_palette(1, false, false).get(),
-            0,
-            2)
-        < 0)
+/* restore the terminal's state from a checkpoint, returns false on
+ * error */
+bool load_checkpoint(VT102 *term, std::string const &path)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        perror(("open(\"" + path + "\")").c_str());
+        return false;
+    }
+    std::string snapshot;
+    char buf[65536];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) != 0;)
     {
-        throw std::runtime_error(
-            "failed to set palette colours "
-            + std::string(SDL_GetError()));
+        snapshot.append(buf, n);
+    }
+    bool const failed = ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        perror(("read(\"" + path + "\")").c_str());
+        return false;
     }
 
-    return surf;
+    try
+    {
+        term->deserialize((uint8_t const *)snapshot.data(), snapshot.size());
+    }
+    catch (std::runtime_error const &e)
+    {
+        fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+        return false;
+    }
+    return true;
 }
 
-/* write to an fd */
-void write_to(int fd, std::string data)
+
+/* render line into row y of the window
+ *  this is specialized on the line attribute, so the glyph geometry is
+ *  fixed for the whole line and double-width lines only visit the cells
+ *  which actually fit on the screen */
+template<Line::Attr attr>
+void render_line(
+    SDL_Surface *surf,
+    GlyphCache const &glyphs,
+    VT102 const &term,
+    Line const &line,
+    ssize_t y,
+    bool show_cursor,
+    bool blink_off)
 {
-    char const *const cstr = data.c_str();
-    size_t size = data.size();
-    size_t bytes_total = 0;
-    do
+    constexpr FontType font_type =\
+        (attr == Line::NORMAL)
+            ? FontType::Normal
+            : (attr == Line::DOUBLE_WIDTH)
+                ? FontType::DoubleWide
+                : FontType::DoubleHigh;
+    constexpr bool double_height =\
+        (   attr == Line::DOUBLE_HEIGHT_UPPER
+         || attr == Line::DOUBLE_HEIGHT_LOWER);
+
+    /* every colouring of the font, already set up */
+    SurfaceFont const *fonts[GlyphCache::variants];
+    for (int v = 0; v < GlyphCache::variants; ++v)
     {
-        ssize_t tmp = write(fd, cstr, size - bytes_total);
-        if (tmp == -1)
+        fonts[v] = &glyphs.font(font_type, term.DECCOLM, v);
+    }
+
+    /* all the glyphs in a font are the same size */
+    int const glyph_w = (*fonts[0])[0]->w,
+              glyph_h = (*fonts[0])[0]->h;
+
+    /* double-height lines only draw the upper or lower half
+     * of each glyph */
+    SDL_Rect src_rect;
+    src_rect.x = 0;
+    src_rect.y = (attr == Line::DOUBLE_HEIGHT_LOWER)? glyph_h / 2 : 0;
+    src_rect.w = glyph_w;
+    src_rect.h = double_height? glyph_h / 2 : glyph_h;
+
+    /* double-width glyphs (including double-height ones) are twice as
+     * wide, so only the first half of the line is visible */
+    ssize_t const visible_cols =\
+        (attr == Line::NORMAL)? term.cols : (term.cols + 1) / 2;
+
+    for (ssize_t x = 0; x < visible_cols; ++x)
+    {
+        Char ch = line[x];
+        int const variant = GlyphCache::variant(
+            term.DECSCNM? false : ch.bold,
+            term.DECSCNM ^ ch.reverse);
+        SDL_Surface *glyph = (*fonts[variant])[ch.glyph];
+        std::array<SDL_Color, 2> const &pal = glyphs.palette(variant);
+
+        /* cursor is a blinking underline or block */
+        if (show_cursor && y == term.curs_y && x == term.curs_x)
         {
-            perror("write");
-            exit(EXIT_FAILURE);
+            ch.blink = true;
+            if (term.setup.block_cursor)
+            {
+                ch.reverse = !ch.reverse;
+            }
+            else
+            {
+                ch.underline = !ch.underline;
+            }
         }
-        bytes_total += (size_t)tmp;
-    } while (bytes_total < size);
+
+        SDL_Rect scr_rect;
+        scr_rect.w = src_rect.w;
+        scr_rect.h = src_rect.h;
+        scr_rect.x = x * src_rect.w;
+        scr_rect.y = y * src_rect.h;
+
+        if (ch.reverse)
+        {
+            std::array<SDL_Color, 2> const &rpal = glyphs.palette(
+                GlyphCache::variant(ch.bold, term.DECSCNM ^ ch.reverse));
+
+            /* fill the character area with the foreground
+             * colour, so the glyph is visible */
+            SDL_FillRect(
+                surf,
+                &scr_rect,
+                SDL_MapRGB(
+                    surf->format,
+                    rpal[0].r,
+                    rpal[0].g,
+                    rpal[0].b));
+        }
+
+        /* draw the character */
+        if (!ch.blink || !blink_off)
+        {
+            /* draw the glyph */
+            SDL_BlitSurface(
+                glyph,
+                &src_rect,
+                surf,
+                &scr_rect);
+
+            if (ch.underline)
+            {
+                /* TODO: determine the underline
+                 * position through the font? */
+                /* draw an underline */
+                SDL_Rect rect;
+                rect.w = scr_rect.w;
+                rect.h = 1;
+                rect.x = scr_rect.x;
+                rect.y = scr_rect.y + scr_rect.h - 2;
+
+                SDL_FillRect(
+                    surf,
+                    &rect,
+                    SDL_MapRGB(
+                        surf->format,
+                        pal[1].r,
+                        pal[1].g,
+                        pal[1].b));
+            }
+        }
+    }
 }
 
+/* where the parser trace is dumped (on SIGUSR2, on a crash and on
+ * exit), empty for nowhere; a fixed buffer so the signal handler
+ * needn't touch anything that allocates */
+char trace_dump_path[4096];
 
+/* write the trace to trace_dump_path, async-signal-safe */
+void dump_trace(void)
+{
+    int fd = open(
+        trace_dump_path,
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+    if (fd != -1)
+    {
+        trace_dump(fd);
+        close(fd);
+    }
+}
 
-/* Terminal Emulator */
-int main (int argc, char *argv[])
+void trace_signal_handler(int sig)
 {
-    if (argc == 2)
+    int const saved_errno = errno;
+    dump_trace();
+    errno = saved_errno;
+    /* the crash handlers were reset on the way in, so this time the
+     * signal does what it would have done */
+    if (sig != SIGUSR2)
     {
-        VT102CONFIG_do_trace = (std::string(argv[1]) == "--trace");
+        raise(sig);
     }
+}
 
-    int err = 0;
+/* dump the trace on SIGUSR2 and on a crash */
+void install_trace_handlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = trace_signal_handler;
+    sigemptyset(&action.sa_mask);
 
-    /* open the pseudoterminal master fd */
-    int master = posix_openpt(O_RDWR);
-    if (master == -1)
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &action, nullptr);
+
+    action.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT })
     {
-        perror("open(\"/dev/ptmx\")");
-        exit(EXIT_FAILURE);
+        sigaction(sig, &action, nullptr);
     }
+}
 
-    char const *const slave_filename = ptsname(master);
-    if (slave_filename == nullptr)
+/* CPUs this process may run on, which can be fewer than the machine
+ * has */
+static size_t usable_cpus(void)
+{
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
     {
-        perror("ptsname");
-        exit(EXIT_FAILURE);
+        return CPU_COUNT(&cpus);
     }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/* print what the hosts have sent so far on stderr */
+void parse_stats_signal_handler(int sig)
+{
+    int const saved_errno = errno;
+    parse_stats_dump(STDERR_FILENO);
+    errno = saved_errno;
+}
 
-    err = grantpt(master);
-    if (err == -1)
+/* Terminal Emulator */
+int main (int argc, char *argv[])
+{
+    /* parser backlog at which we stop reading from the host */
+    size_t input_high_water = InQueue::capacity / 2;
+    /* parser backlog at which automatic XOFF/XON are sent (0 means
+     * derive XOFF from the high-water mark, and XON from XOFF) */
+    size_t xoff_threshold = 0,
+           xon_threshold = 0;
+    /* number of headless sessions to host (0 for a normal terminal),
+     * and how many more of them are batch sessions */
+    size_t host_sessions = 0,
+           batch_sessions = 0;
+    /* number of parser threads for the host; more than there are CPUs
+     * only adds to the sessions' queue latency */
+    size_t parsers = usable_cpus();
+    /* bytes per parser turn, and the interactive and batch shares
+     * (0 means the defaults) */
+    size_t quantum = 0;
+    unsigned interactive_weight = 0,
+             batch_weight = 0;
+    /* seconds between the host's reports */
+    unsigned long report_interval = 10;
+    /* scrollback lines kept in memory, and where to keep the rest
+     * (empty to drop them) */
+    size_t scrollback_lines = Scrollback::default_capacity;
+    std::string spill_dir;
+    /* where to record the session (empty to not record), and how
+     * often to save the terminal's state in it, in seconds */
+    std::string record_path;
+    double keyframe_interval = 30;
+    /* recording to play back instead (empty for a normal terminal),
+     * and how far into it to go, in seconds */
+    std::string replay_path;
+    double seek_to = 0;
+    /* where to save the terminal's state every checkpoint_interval
+     * seconds and on exit, and where to restore it from at startup
+     * (empty for neither) */
+    std::string checkpoint_path,
+                restore_path;
+    double checkpoint_interval = 10;
+    /* where to serve metrics (empty to not serve them) */
+    std::string metrics_path;
+    /* the program to run */
+    char *const shell[] = { (char *)"/bin/bash", nullptr };
+    char *const *command = shell;
+    /* shell command for the host's batch sessions to run instead,
+     * for a mix of a few busy sessions among many quiet ones */
+    char *batch_shell[] = {
+        (char *)"/bin/sh", (char *)"-c", nullptr, nullptr };
+
+    for (int i = 1; i < argc; ++i)
     {
-        perror("grantpt");
-        exit(EXIT_FAILURE);
+        std::string arg = argv[i];
+        if (arg == "--trace-dump" && i + 1 < argc)
+        {
+            snprintf(
+                trace_dump_path,
+                sizeof(trace_dump_path),
+                "%s",
+                argv[++i]);
+        }
+        /* print a dump made with --trace-dump and exit */
+        else if (arg == "--decode-trace" && i + 1 < argc)
+        {
+            FILE *in = fopen(argv[++i], "rb");
+            if (in == nullptr)
+            {
+                perror(argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            bool ok = trace_decode(in, stdout);
+            fclose(in);
+            if (!ok)
+            {
+                fprintf(stderr, "%s: not a trace dump\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            return EXIT_SUCCESS;
+        }
+        else if (arg == "--metrics-socket" && i + 1 < argc)
+        {
+            metrics_path = argv[++i];
+        }
+        else if (arg == "--report-errors")
+        {
+            VT102CONFIG_report_errors = true;
+        }
+        else if (arg == "--input-hwm" && i + 1 < argc)
+        {
+            input_high_water = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--xoff" && i + 1 < argc)
+        {
+            xoff_threshold = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--xon" && i + 1 < argc)
+        {
+            xon_threshold = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--host" && i + 1 < argc)
+        {
+            host_sessions = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            batch_sessions = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--batch-command" && i + 1 < argc)
+        {
+            batch_shell[2] = argv[++i];
+        }
+        else if (arg == "--parsers" && i + 1 < argc)
+        {
+            parsers = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--quantum" && i + 1 < argc)
+        {
+            quantum = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--interactive-weight" && i + 1 < argc)
+        {
+            interactive_weight = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--batch-weight" && i + 1 < argc)
+        {
+            batch_weight = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--report-interval" && i + 1 < argc)
+        {
+            report_interval = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--scrollback" && i + 1 < argc)
+        {
+            scrollback_lines = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "--spill-dir" && i + 1 < argc)
+        {
+            spill_dir = argv[++i];
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            record_path = argv[++i];
+        }
+        else if (arg == "--keyframe-interval" && i + 1 < argc)
+        {
+            keyframe_interval = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replay_path = argv[++i];
+        }
+        else if (arg == "--seek" && i + 1 < argc)
+        {
+            seek_to = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc)
+        {
+            checkpoint_path = argv[++i];
+        }
+        else if (arg == "--checkpoint-interval" && i + 1 < argc)
+        {
+            checkpoint_interval = strtod(argv[++i], nullptr);
+        }
+        else if (arg == "--restore" && i + 1 < argc)
+        {
+            restore_path = argv[++i];
+        }
+        /* everything after `--` is the command to run */
+        else if (arg == "--" && i + 1 < argc)
+        {
+            command = &argv[i + 1];
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument '%s'\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct sigaction stats_action;
+    memset(&stats_action, 0, sizeof(stats_action));
+    stats_action.sa_handler = parse_stats_signal_handler;
+    sigemptyset(&stats_action.sa_mask);
+    stats_action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &stats_action, nullptr);
+
+    if (trace_dump_path[0] != '\0')
+    {
+        if (trace_enabled)
+        {
+            install_trace_handlers();
+        }
+        else
+        {
+            fprintf(
+                stderr,
+                "tracing isn't built in, build with `make TRACE=1`\n");
+            trace_dump_path[0] = '\0';
+        }
     }
 
-    err = unlockpt(master);
-    if (err == -1)
+    /* scrapes are answered on a thread of the server's own */
+    MetricsServer metrics_server{};
+    if (!metrics_path.empty() && !metrics_server.open(metrics_path))
     {
-        perror("unlockpt");
+        perror(("metrics socket " + metrics_path).c_str());
         exit(EXIT_FAILURE);
     }
 
+    /* headless multi-session host */
+    if (host_sessions + batch_sessions != 0)
+    {
+        SessionHost host{std::max<size_t>(parsers, 1)};
+        if (quantum != 0)
+        {
+            host.budget.quantum = quantum;
+        }
+        if (interactive_weight != 0)
+        {
+            host.budget.weight[Session::INTERACTIVE] = interactive_weight;
+        }
+        if (batch_weight != 0)
+        {
+            host.budget.weight[Session::BATCH] = batch_weight;
+        }
+        host.history.lines = scrollback_lines;
+        host.history.spill_dir = spill_dir;
 
+        for (size_t i = 0; i < host_sessions + batch_sessions; ++i)
+        {
+            Session::Priority priority = (i < host_sessions)
+                ? Session::INTERACTIVE
+                : Session::BATCH;
+            char *const *session_command =\
+                (priority == Session::BATCH && batch_shell[2] != nullptr)
+                ? batch_shell
+                : command;
+            if (!host.spawn(session_command, 80, 24, priority))
+            {
+                perror("spawn");
+                break;
+            }
+        }
+        host.run(std::chrono::seconds(std::max(report_interval, 1ul)));
+        return EXIT_SUCCESS;
+    }
 
-    pid_t pid = fork();
-    /* child */
-    if (pid == 0)
+    /* headless playback, print the screen as it was at seek_to */
+    if (!replay_path.empty())
     {
-        close(master);
-
-        int slave = open(slave_filename, O_RDWR);
-        if (slave == -1)
+        Player player{};
+        if (!player.open(replay_path))
         {
-            perror("open(slave)");
             exit(EXIT_FAILURE);
         }
 
-        /* create new session */
-        setsid();
-
-        /* make the tty a controlling tty of the calling process
-         * (???) */
-        if (ioctl(slave, TIOCSCTTY, nullptr) == -1)
+        VT102 replay{};
+        Player::SeekStats stats;
+        auto const start = std::chrono::steady_clock::now();
+        try
+        {
+            if (!player.seek(
+                    &replay,
+                    std::max(seek_to, 0.0) * 1e6,
+                    &stats))
+            {
+                fprintf(stderr, "%s: damaged recording\n", argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        catch (std::runtime_error const &e)
         {
-            perror("ioctl(TIOCSCTTY)");
+            fprintf(stderr, "%s: %s\n", replay_path.c_str(), e.what());
             exit(EXIT_FAILURE);
         }
+        double const seek_time =\
+            std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
 
-        /* rebind stdin, stdout, and stderr to slave */
-        dup2(slave, 0);
-        dup2(slave, 1);
-        dup2(slave, 2);
-        close(slave);
-
-        if (putenv((char *)"TERM=vt102") != 0)
+        for (Row const &row : replay.screen)
         {
-            perror("putenv");
-            exit(EXIT_FAILURE);
+            std::string text;
+            for (Char const &chr : row->chars)
+            {
+                text.push_back(isprint(chr.ch)? chr.ch : ' ');
+            }
+            text.erase(text.find_last_not_of(' ') + 1);
+            printf("%s\n", text.c_str());
         }
-        execl("/bin/bash", "/bin/bash", (char *)nullptr);
-        perror("execle");
-        exit(EXIT_FAILURE);
+        fprintf(
+            stderr,
+            "seek to %.3fs of %.3fs: %s at %.3fs, %llu frames "
+            "(%llu bytes) replayed in %.3fms\n",
+            seek_to,
+            player.duration / 1e6,
+            stats.from_keyframe? "keyframe" : "start",
+            stats.keyframe_time / 1e6,
+            stats.frames,
+            stats.bytes,
+            seek_time * 1e3);
+        return EXIT_SUCCESS;
     }
 
+    int err = 0;
 
-    /* fork() parent */
     VT102 term{};
+    OutQueue outqueue{};
+    InQueue inqueue{input_high_water};
+
+    /* ask the host to stop well before the input queue fills up, and
+     * to go on once most of that has been parsed; XOFF must come at or
+     * below the high-water mark, where the reader stops reading, and
+     * XON below XOFF, or they'd be sent in turn forever */
+    size_t const high_water =\
+        std::min(std::max(input_high_water, (size_t)1), InQueue::capacity);
+    term.flow.xoff_threshold =\
+        (xoff_threshold != 0)? xoff_threshold : high_water / 2;
+    term.flow.xon_threshold =\
+        (xon_threshold != 0)? xon_threshold : term.flow.xoff_threshold / 4;
+    if (    term.flow.xon_threshold >= term.flow.xoff_threshold
+        ||  term.flow.xoff_threshold > high_water)
+    {
+        fprintf(
+            stderr,
+            "--xon (%zu) must be below --xoff (%zu), which must be at "
+            "most --input-hwm (%zu)\n",
+            term.flow.xon_threshold,
+            term.flow.xoff_threshold,
+            high_water);
+        exit(EXIT_FAILURE);
+    }
+
+    /* pick up where a previous terminal left off, the shell is
+     * started at the restored size */
+    if (!restore_path.empty() && !load_checkpoint(&term, restore_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    term.scrollback.set_capacity(scrollback_lines);
+    if (    !spill_dir.empty()
+        &&  !term.scrollback.spill_to(
+                spill_dir + "/term-" + std::to_string(getpid())))
+    {
+        perror(("spill to " + spill_dir).c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    /* start the shell
+     *  the master fd is non-blocking, so a host which stops reading
+     *  can't stall the UI; output waits in outqueue instead */
+    std::string slave_filename;
+    int master = -1;
+    pid_t pid = spawn_pty(
+        command,
+        term.cols,
+        term.rows,
+        &master,
+        &slave_filename);
+    if (pid == -1)
+    {
+        perror("spawn_pty");
+        exit(EXIT_FAILURE);
+    }
 
     /* TODO: load rc file into term.user_setup */
 
@@ -497,21 +1093,17 @@ int main (int argc, char *argv[])
     }
 
 
-    /* load the font images */
-    for (size_t i = 0; i < 6; ++i)
+    /* load the font images, already coloured for the current
+     * brightness */
+    std::shared_ptr<GlyphCache const> glyphs;
+    try
     {
-        FILE *img = fopen(font_filenames[i].c_str(), "r");
-        if (img == nullptr)
-        {
-            perror(("fopen(\"" + font_filenames[i] + "\")").c_str());
-            exit(EXIT_FAILURE);
-        }
-        Font font_image = read_font(img);
-        for (size_t j = 0; j < fonts[i].size(); ++j)
-        {
-            fonts[i][j] = image_to_surface(font_image[j]);
-        }
-        fclose(img);
+        glyphs = GlyphCache::get(term.setup.brightness);
+    }
+    catch (std::runtime_error const &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        exit(EXIT_FAILURE);
     }
 
 
@@ -520,8 +1112,8 @@ int main (int argc, char *argv[])
         argv[0],
         SDL_WINDOWPOS_UNDEFINED,
         SDL_WINDOWPOS_UNDEFINED,
-        term.cols * fonts[0][0]->w,
-        term.rows * fonts[0][0]->h,
+        term.cols * glyphs->font(FontType::Normal, false, 0)[0]->w,
+        term.rows * glyphs->font(FontType::Normal, false, 0)[0]->h,
         SDL_WINDOW_RESIZABLE);
 
     SDL_Surface *surf = nullptr;
@@ -532,10 +1124,47 @@ int main (int argc, char *argv[])
     SDL_TimerID timer_60hz =\
         SDL_AddTimer(1000 / 60, callback_timer_60hz, nullptr);
 
+    Recorder recorder{};
+    if (    !record_path.empty()
+        &&  !recorder.open(record_path, term.cols, term.rows))
+    {
+        perror(("open(\"" + record_path + "\")").c_str());
+        exit(EXIT_FAILURE);
+    }
+    /* output bytes parsed so far, and how often to save the
+     * terminal's state so playback can seek */
+    unsigned long long parsed_bytes = 0;
+    auto const keyframe_every =\
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(std::max(keyframe_interval, 1.0)));
+    if (recorder.is_open())
+    {
+        std::string snapshot;
+        term.serialize(&snapshot);
+        recorder.keyframe(parsed_bytes, snapshot);
+    }
+    /* time spent parsing, to compare the recording overhead with */
+    std::chrono::nanoseconds parse_time(0);
+
+    auto const checkpoint_every =\
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(
+                std::max(checkpoint_interval, 1.0)));
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    if (!checkpoint_path.empty())
+    {
+        checkpoints.reset(new CheckpointWriter(checkpoint_path));
+    }
+
+    MasterMonitor monitor{
+        master,
+        &inqueue,
+        recorder.is_open()? &recorder : nullptr};
     SDL_Thread *master_monitor = SDL_CreateThread(
         thread_monitor_master_fd,
         "master_monitor",
-        &master);
+        &monitor);
 
 
     bool blink_off = false,
@@ -543,19 +1172,25 @@ int main (int argc, char *argv[])
           * right size before the first render */
          use_132_columns = !term.DECCOLM;
 
+    /* how many lines the view is scrolled back */
+    size_t view_offset = 0;
+
     /* mainloop */
-    bool update_screen = true;
+    bool update_screen = true,
+         flush_output = false;
     for(bool done = false; !done;)
     {
         if (update_screen)
         {
+            auto const frame_start = std::chrono::steady_clock::now();
+
             /* make sure the screen size is sync'd
              * with the emulator */
             if (term.DECCOLM != use_132_columns)
             {
                 use_132_columns = term.DECCOLM;
-                SurfaceFont fnt =\
-                    get_font(FontType::Normal, use_132_columns);
+                SurfaceFont const &fnt =\
+                    glyphs->font(FontType::Normal, use_132_columns, 0);
                 SDL_SetWindowSize(
                     win,
                     term.cols * fnt[0]->w,
@@ -565,11 +1200,16 @@ int main (int argc, char *argv[])
 
 
 
+            /* SET-UP may have changed the brightness */
+            if (    GlyphCache::step(term.setup.brightness)
+                !=  glyphs->brightness_step)
+            {
+                glyphs = GlyphCache::get(term.setup.brightness);
+            }
+
             /* clear the screen */
-            auto pal = get_palette(
-                term.setup.brightness,
-                term.DECSCNM,
-                false);
+            std::array<SDL_Color, 2> const &pal = glyphs->palette(
+                GlyphCache::variant(false, term.DECSCNM));
             SDL_FillRect(
                 surf,
                 nullptr,
@@ -579,154 +1219,55 @@ int main (int argc, char *argv[])
                     pal[0].g,
                     pal[0].b));
 
-            /* render the screen */
+            /* render the screen, scrolled back view_offset lines
+             * into the scrollback */
+            view_offset = std::min(view_offset, term.scrollback.size());
             for (ssize_t y = 0; y < term.rows; ++y)
             {
-                Line line = term.screen[y];
-                FontType font_type = FontType::Normal;
-                switch (line.attr)
+                Line history{};
+                Line const *line = &history;
+                if ((size_t)y < view_offset)
+                {
+                    history = term.scrollback.get(
+                        term.scrollback.size() - view_offset + y,
+                        term.cols);
+                }
+                else
+                {
+                    line = term.screen[y - view_offset].get();
+                }
+
+                bool const show_cursor = (view_offset == 0);
+                switch (line->attr)
                 {
                 case Line::NORMAL:
-                    font_type = FontType::Normal;
+                    render_line<Line::NORMAL>(
+                        surf, *glyphs, term, *line, y,
+                        show_cursor, blink_off);
                     break;
                 case Line::DOUBLE_HEIGHT_UPPER:
+                    render_line<Line::DOUBLE_HEIGHT_UPPER>(
+                        surf, *glyphs, term, *line, y,
+                        show_cursor, blink_off);
+                    break;
                 case Line::DOUBLE_HEIGHT_LOWER:
-                    font_type = FontType::DoubleHigh;
+                    render_line<Line::DOUBLE_HEIGHT_LOWER>(
+                        surf, *glyphs, term, *line, y,
+                        show_cursor, blink_off);
                     break;
                 case Line::DOUBLE_WIDTH:
-                    font_type = FontType::DoubleWide;
+                    render_line<Line::DOUBLE_WIDTH>(
+                        surf, *glyphs, term, *line, y,
+                        show_cursor, blink_off);
                     break;
                 }
-
-                SurfaceFont font = get_font(font_type, term.DECCOLM);
-
-                for (ssize_t x = 0; x < term.cols; ++x)
-                {
-                    Char ch = term.getc_at(x, y);
-                    int fontidx = term.fontidx(ch.charset, ch.ch);
-                    SDL_Surface *glyph = font[fontidx];
-
-                    auto pal = get_palette(
-                        term.setup.brightness,
-                        term.DECSCNM ^ ch.reverse,
-                        term.DECSCNM? false : ch.bold);
-
-                    SDL_SetPaletteColors(
-                        glyph->format->palette,
-                        pal.get(),
-                        0,
-                        2);
-
-                    /* cursor is a blinking underline or block */
-                    if (y == term.curs_y && x == term.curs_x)
-                    {
-                        ch.blink = true;
-                        if (term.setup.block_cursor)
-                        {
-                            ch.reverse = !ch.reverse;
-                        }
-                        else
-                        {
-                            ch.underline = !ch.underline;
-                        }
-                    }
-
-                    SDL_Rect scr_rect;
-                    scr_rect.w = glyph->w;
-                    scr_rect.h = glyph->h;
-                    scr_rect.x = x * glyph->w;
-                    scr_rect.y = y * glyph->h;
-
-                    SDL_Rect *src_rect = nullptr;
-
-                    if (line.attr == Line::DOUBLE_WIDTH)
-                    {
-                        src_rect = new SDL_Rect{};
-                        src_rect->x = 0;
-                        src_rect->y = 0;
-                        src_rect->w = glyph->w;
-                        src_rect->h = glyph->h;
-                    }
-                    if (line.attr == Line::DOUBLE_HEIGHT_UPPER)
-                    {
-                        /* crop out the bottom half of the glyph */
-                        src_rect = new SDL_Rect{};
-                        src_rect->x = 0;
-                        src_rect->y = 0;
-                        src_rect->w = glyph->w;
-                        src_rect->h = glyph->h / 2;
-
-                        scr_rect.y = y * (glyph->h / 2);
-                        scr_rect.h = glyph->h / 2;
-                    }
-                    if (line.attr == Line::DOUBLE_HEIGHT_LOWER)
-                    {
-                        /* crop out the top half of the glyph */
-                        src_rect = new SDL_Rect{};
-                        src_rect->x = 0;
-                        src_rect->y = glyph->h / 2;
-                        src_rect->w = glyph->w;
-                        src_rect->h = glyph->h / 2;
-
-                        scr_rect.y = y * (glyph->h / 2);
-                        scr_rect.h = glyph->h / 2;
-                    }
-
-                    if (ch.reverse)
-                    {
-                        auto rpal = get_palette(
-                            term.setup.brightness,
-                            term.DECSCNM ^ ch.reverse,
-                            ch.bold);
-
-                        /* fill the character area with the foreground
-                         * colour, so the glyph is visible */
-                        SDL_FillRect(
-                            surf,
-                            &scr_rect,
-                            SDL_MapRGB(
-                                surf->format,
-                                rpal[0].r,
-                                rpal[0].g,
-                                rpal[0].b));
-                    }
-
-                    /* draw the character */
-                    if (!ch.blink || !blink_off)
-                    {
-                        /* draw the glyph */
-                        SDL_BlitSurface(
-                            glyph,
-                            src_rect,
-                            surf,
-                            &scr_rect);
-
-                        if (ch.underline)
-                        {
-                            /* TODO: determine the underline
-                             * position through the font? */
-                            /* draw an underline */
-                            SDL_Rect rect;
-                            rect.w = scr_rect.w;
-                            rect.h = 1;
-                            rect.x = scr_rect.x;
-                            rect.y = scr_rect.y + scr_rect.h - 2;
-
-                            SDL_FillRect(
-                                surf,
-                                &rect,
-                                SDL_MapRGB(
-                                    surf->format,
-                                    pal[1].r,
-                                    pal[1].g,
-                                    pal[1].b));
-                        }
-                    }
-                    delete src_rect;
-                }
             }
             SDL_UpdateWindowSurface(win);
             update_screen = false;
+
+            metrics.frame(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - frame_start).count());
         }
 
         /* handle events */
@@ -749,15 +1290,15 @@ int main (int argc, char *argv[])
               {
                 surf = SDL_GetWindowSurface(win);
 
-                SurfaceFont fnt =\
-                    get_font(FontType::Normal, term.DECCOLM);
+                SurfaceFont const &fnt =\
+                    glyphs->font(FontType::Normal, term.DECCOLM, 0);
                 int cols = event.window.data1 / fnt[0]->w;
                 int rows = event.window.data2 / fnt[0]->h;
 
                 term.resize(cols, rows);
 
 
-                int slave = open(slave_filename, O_RDWR);
+                int slave = open(slave_filename.c_str(), O_RDWR);
                 if (slave == -1)
                 {
                     perror("open(slave)");
@@ -772,6 +1313,7 @@ int main (int argc, char *argv[])
                     exit(EXIT_FAILURE);
                 }
                 close(slave);
+                recorder.resize(cols, rows);
               } break;
 
             case SDL_WINDOWEVENT_MOVED:
@@ -782,25 +1324,43 @@ int main (int argc, char *argv[])
             break;
 
         case SDL_KEYDOWN:
+            /* shift+page up/down scroll the view through the
+             * scrollback, by half a screen at a time */
+            if (    (event.key.keysym.mod & KMOD_SHIFT)
+                &&  (   event.key.keysym.sym == SDLK_PAGEUP
+                     || event.key.keysym.sym == SDLK_PAGEDOWN))
+            {
+                size_t const half = std::max<ssize_t>(term.rows / 2, 1);
+                if (event.key.keysym.sym == SDLK_PAGEUP)
+                {
+                    view_offset = std::min(
+                        view_offset + half,
+                        term.scrollback.size());
+                }
+                else
+                {
+                    view_offset -= std::min(view_offset, half);
+                }
+                update_screen = true;
+                break;
+            }
+            /* anything else goes back to the bottom */
+            if (view_offset != 0)
+            {
+                view_offset = 0;
+                update_screen = true;
+            }
+
             if (!term.KAM)
             {
                 if (   term.DECARM
                     || (!term.DECARM && event.key.repeat == 0))
                 {
-                    bool success = true;
-                    /* check if the key is bound */
-                    try
-                    {
-                        keymap.at(event.key.keysym.sym);
-                    }
-                    catch (std::out_of_range &e)
-                    {
-                        success = false;
-                    }
+                    int const key = bound_key(event.key.keysym.sym);
 
                     /* if the key is bound, send the appropriate
                      * keypress event to the terminal */
-                    if (success)
+                    if (key != -1)
                     {
                         unsigned mod = VT102::Modifiers::None;
                         if (event.key.keysym.mod & KMOD_CTRL)
@@ -815,8 +1375,7 @@ int main (int argc, char *argv[])
                         {
                             mod |= VT102::Modifiers::CapsLock;
                         }
-                        term.keyboard_input(
-                            keymap.at(event.key.keysym.sym), mod);
+                        term.keyboard_input((VT102::Key)key, mod);
                     }
                 }
             }
@@ -829,18 +1388,34 @@ int main (int argc, char *argv[])
             case 0:
                 blink_off = !blink_off;
                 break;
-            /* byte received from the master fd */
+            /* data received from the master fd */
             case 1:
-                try
+              {
+                inqueue.disarm();
+
+                /* parse a bounded amount per wakeup, so keyboard and
+                 * window events aren't starved by a flooding host */
+                uint8_t buf[4096];
+                size_t size = inqueue.read((char *)buf, sizeof(buf));
+                auto const start = std::chrono::steady_clock::now();
+                term.interpret_bytes(buf, size);
+                parse_time += std::chrono::steady_clock::now() - start;
+                parsed_bytes += size;
+                metrics.parse_ns.store(
+                    parse_time.count(),
+                    std::memory_order_relaxed);
+
+                /* send XOFF/XON straight away */
+                if (term.flow_control(inqueue.size()))
                 {
-                    term.interpret_byte(*(char *)event.user.data1);
+                    flush_output = true;
                 }
-                catch (std::exception &e)
+
+                if (inqueue.size() != 0 && inqueue.arm())
                 {
-                    printf("interpret_byte: %s\n", e.what());
+                    push_input_event();
                 }
-                delete (char *)event.user.data1;
-                break;
+              } break;
             /* master fd disconnected */
             case 2:
                 done = true;
@@ -849,12 +1424,43 @@ int main (int argc, char *argv[])
             /* 60th of a second notification */
             case 3:
                 update_screen = true;
+                flush_output = true;
+
+                metrics.input_queued.store(
+                    inqueue.size(),
+                    std::memory_order_relaxed);
+                metrics.output_queued.store(
+                    outqueue.size() + term.outbuffer.size(),
+                    std::memory_order_relaxed);
+                metrics.xoff_ns.store(
+                    term.flow.xoff_time.count(),
+                    std::memory_order_relaxed);
+                metrics.session_memory[0].store(
+                    term.memory_usage(),
+                    std::memory_order_relaxed);
+                metrics.sessions.store(1, std::memory_order_relaxed);
+                recorder.parsed(parsed_bytes);
+                if (recorder.keyframe_due(keyframe_every))
+                {
+                    std::string snapshot;
+                    term.serialize(&snapshot);
+                    recorder.keyframe(parsed_bytes, snapshot);
+                }
+                recorder.flush();
+
+                if (    checkpoints
+                    &&      std::chrono::steady_clock::now()
+                        >=  last_checkpoint + checkpoint_every)
+                {
+                    checkpoints->save(term);
+                    last_checkpoint = std::chrono::steady_clock::now();
+                }
                 break;
             }
             break;
         }
 
-        /* write any data from the terminal to the child */
+        /* queue any data from the terminal for the child */
         if (term.outbuffer.size() != 0)
         {
 #if 0
@@ -872,28 +1478,113 @@ int main (int argc, char *argv[])
             }
             printf("'\n");
 #endif
-            write_to(master, term.outbuffer);
-            term.outbuffer.erase();
+            /* anything which doesn't fit stays in outbuffer
+             * until the queue drains */
+            size_t queued = outqueue.enqueue(
+                term.outbuffer.data(),
+                term.outbuffer.size());
+            recorder.input(term.outbuffer.data(), queued);
+            term.outbuffer.erase(0, queued);
+        }
+
+        /* small writes (ie. keystrokes) are merged and written once
+         * per tick, unless there's a lot waiting */
+        if (flush_output || outqueue.size() >= 4096)
+        {
+            flush_output = false;
+            if (outqueue.flush(master) == -1)
+            {
+                /* EIO means the child process quit */
+                if (errno != EIO)
+                {
+                    perror("writev(master)");
+                }
+                done = true;
+            }
         }
     }
 
+    if (checkpoints)
+    {
+        checkpoints->save(term);
+        checkpoints->stop();
+    }
 
     kill(pid, SIGKILL);
+    inqueue.close();
     int code = 0;
     SDL_WaitThread(master_monitor, &code);
     printf("master_monitor: %d\n", code);
+    if (recorder.is_open())
+    {
+        recorder.close();
+        double const recording =\
+            std::chrono::duration<double>(recorder.stats.time).count();
+        double const parsing =\
+            std::chrono::duration<double>(parse_time).count();
+        printf(
+            "recording: %llu frames (%llu keyframes), %llu bytes, %llu "
+            "bytes in %llu writes, %.3fs (%.1f%% of %.3fs parsing)\n",
+            recorder.stats.frames,
+            recorder.stats.keyframes,
+            recorder.stats.payload_bytes,
+            recorder.stats.file_bytes,
+            recorder.stats.writes,
+            recording,
+            (parsing > 0)? 100 * recording / parsing : 0.0,
+            parsing);
+    }
+    printf(
+        "inqueue: %llu bytes, %zu peak queued, "
+        "%llu backpressure episodes, %.3fs backpressured\n",
+        inqueue.stats.bytes_in,
+        inqueue.stats.queued_peak,
+        inqueue.stats.backpressure_episodes,
+        std::chrono::duration<double>(
+            inqueue.stats.backpressure_time).count());
+    printf(
+        "flow control: %llu XOFF episodes, %.3fs XOFF'd\n",
+        term.flow.xoff_episodes,
+        std::chrono::duration<double>(term.flow.xoff_time).count());
+    printf(
+        "outqueue: %llu bytes in %llu writes, %zu peak queued, "
+        "%.3fs blocked\n",
+        outqueue.stats.bytes_written,
+        outqueue.stats.writes,
+        outqueue.stats.queued_peak,
+        std::chrono::duration<double>(outqueue.stats.blocked_time).count());
+    printf(
+        "errors: %llu unknown escapes, %llu unknown control sequences, "
+        "%llu unknown parameters, %llu bad parameters, "
+        "%llu unimplemented\n",
+        term.errors[(size_t)VT102::Error::UnknownEscape],
+        term.errors[(size_t)VT102::Error::UnknownControlSequence],
+        term.errors[(size_t)VT102::Error::UnknownParameter],
+        term.errors[(size_t)VT102::Error::BadParameters],
+        term.errors[(size_t)VT102::Error::Unimplemented]);
+    printf("parse stats:\n");
+    fflush(stdout);
+    parse_stats_dump(STDOUT_FILENO);
+    printf(
+        "memory: %zu bytes terminal, %zu bytes glyph cache (shared)\n",
+        term.memory_usage(),
+        GlyphCache::memory_usage());
+    printf(
+        "scrollback: %zu lines, %zu spilled (%zu bytes on disk)\n",
+        term.scrollback.size(),
+        term.scrollback.spilled_lines(),
+        term.scrollback.spilled_bytes());
     close(master);
 
+    if (trace_dump_path[0] != '\0')
+    {
+        dump_trace();
+    }
+
     SDL_RemoveTimer(blink_timer);
     SDL_RemoveTimer(timer_60hz);
 
-    for (SurfaceFont font : fonts)
-    {
-        for (SDL_Surface *s : font)
-        {
-            SDL_FreeSurface(s);
-        }
-    }
+    glyphs.reset();
     SDL_DestroyWindow(win);
     SDL_Quit();
 
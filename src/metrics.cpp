@@ -0,0 +1,371 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * metrics.cpp
+ *
+ *  Prometheus metrics endpoint
+ *
+ */
+
+#include "metrics.h"
+#include "parsestats.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+
+Metrics metrics;
+
+/* how long a client gets to send its request, in milliseconds */
+static int const REQUEST_TIMEOUT = 1000;
+
+
+void Metrics::frame(uint64_t ns)
+{
+    /* only the render thread counts frames */
+    auto const add = [](std::atomic<uint64_t> &n, uint64_t k)
+    {
+        n.store(n.load(std::memory_order_relaxed) + k,
+                std::memory_order_relaxed);
+    };
+
+    add(frames, 1);
+    add(frame_ns, ns);
+    size_t bucket = 0;
+    while (    bucket < METRICS_FRAME_BUCKET_COUNT
+           &&  ns > METRICS_FRAME_BUCKETS[bucket] * 1e9)
+    {
+        ++bucket;
+    }
+    add(frame_buckets[bucket], 1);
+}
+
+
+
+static void append(std::string *out, char const *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append(std::string *out, char const *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    *out += line;
+}
+
+static uint64_t get(std::atomic<uint64_t> const &n)
+{
+    return n.load(std::memory_order_relaxed);
+}
+
+static void metric_header(
+    std::string *out,
+    char const *name,
+    char const *type,
+    char const *help)
+{
+    append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+std::string metrics_text(void)
+{
+    std::string out;
+
+    ParseStatsTotals totals;
+    parse_stats_totals(&totals);
+    uint64_t parsed = 0;
+    for (uint64_t bytes : totals.bytes)
+    {
+        parsed += bytes;
+    }
+    metric_header(
+        &out,
+        "vt102_parsed_bytes_total",
+        "counter",
+        "Bytes from the host parsed.");
+    append(&out, "vt102_parsed_bytes_total %" PRIu64 "\n", parsed);
+    metric_header(
+        &out,
+        "vt102_parse_seconds_total",
+        "counter",
+        "Time spent parsing.");
+    append(
+        &out,
+        "vt102_parse_seconds_total %.9f\n",
+        get(metrics.parse_ns) / 1e9);
+
+    metric_header(
+        &out,
+        "vt102_input_queue_bytes",
+        "gauge",
+        "Bytes from the host waiting to be parsed.");
+    append(
+        &out,
+        "vt102_input_queue_bytes %" PRIu64 "\n",
+        get(metrics.input_queued));
+    metric_header(
+        &out,
+        "vt102_output_queue_bytes",
+        "gauge",
+        "Bytes waiting to be written to the host.");
+    append(
+        &out,
+        "vt102_output_queue_bytes %" PRIu64 "\n",
+        get(metrics.output_queued));
+
+    metric_header(
+        &out,
+        "vt102_backpressure_seconds_total",
+        "counter",
+        "Time the host reader spent waiting for the parser.");
+    append(
+        &out,
+        "vt102_backpressure_seconds_total %.9f\n",
+        get(metrics.backpressure_ns) / 1e9);
+    metric_header(
+        &out,
+        "vt102_xoff_seconds_total",
+        "counter",
+        "Time the host spent stopped by XOFF.");
+    append(
+        &out,
+        "vt102_xoff_seconds_total %.9f\n",
+        get(metrics.xoff_ns) / 1e9);
+
+    /* histogram buckets are cumulative */
+    metric_header(
+        &out,
+        "vt102_frame_seconds",
+        "histogram",
+        "Time taken to draw a frame.");
+    uint64_t frames = 0;
+    for (size_t i = 0; i < METRICS_FRAME_BUCKET_COUNT; ++i)
+    {
+        frames += get(metrics.frame_buckets[i]);
+        append(
+            &out,
+            "vt102_frame_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+            METRICS_FRAME_BUCKETS[i],
+            frames);
+    }
+    frames += get(metrics.frame_buckets[METRICS_FRAME_BUCKET_COUNT]);
+    append(
+        &out,
+        "vt102_frame_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+        frames);
+    append(
+        &out,
+        "vt102_frame_seconds_sum %.9f\n",
+        get(metrics.frame_ns) / 1e9);
+    append(&out, "vt102_frame_seconds_count %" PRIu64 "\n", frames);
+
+    metric_header(
+        &out,
+        "vt102_glyph_cache_lookups_total",
+        "counter",
+        "Glyph cache lookups, by whether a cache was already loaded.");
+    append(
+        &out,
+        "vt102_glyph_cache_lookups_total{result=\"hit\"} %" PRIu64 "\n",
+        get(metrics.glyph_cache_hits));
+    append(
+        &out,
+        "vt102_glyph_cache_lookups_total{result=\"miss\"} %" PRIu64 "\n",
+        get(metrics.glyph_cache_misses));
+
+    metric_header(
+        &out,
+        "vt102_session_memory_bytes",
+        "gauge",
+        "Approximate memory used by each session.");
+    size_t const sessions =\
+        std::min<uint64_t>(get(metrics.sessions), METRICS_MAX_SESSIONS);
+    for (size_t i = 0; i < sessions; ++i)
+    {
+        append(
+            &out,
+            "vt102_session_memory_bytes{session=\"%zu\"} %" PRIu64 "\n",
+            i,
+            get(metrics.session_memory[i]));
+    }
+
+    return out;
+}
+
+
+
+bool MetricsServer::open(std::string const &socket_path)
+{
+    close();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    /* a socket left behind by a terminal which didn't exit cleanly is
+     * replaced, anything else at path is left alone */
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(socket_path.c_str());
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1)
+    {
+        return false;
+    }
+    int fds[2];
+    if (    bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+        ||  listen(listen_fd, 8) == -1
+        ||  pipe2(fds, O_CLOEXEC) == -1)
+    {
+        int const saved_errno = errno;
+        ::close(listen_fd);
+        listen_fd = -1;
+        errno = saved_errno;
+        return false;
+    }
+    stop_fd = fds[1];
+    path = socket_path;
+
+    int const wake_fd = fds[0];
+    thread = std::thread([this, wake_fd]()
+    {
+        run_until(wake_fd);
+    });
+    return true;
+}
+
+void MetricsServer::close(void)
+{
+    if (listen_fd == -1)
+    {
+        return;
+    }
+
+    /* closing the write end wakes the thread up */
+    ::close(stop_fd);
+    thread.join();
+
+    ::close(listen_fd);
+    unlink(path.c_str());
+    listen_fd = -1;
+    stop_fd = -1;
+    path.clear();
+}
+
+void MetricsServer::run_until(int wake_fd)
+{
+    for (;;)
+    {
+        struct pollfd fds[2] =\
+        {
+            { listen_fd, POLLIN, 0 },
+            { wake_fd, POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("poll(metrics)");
+            break;
+        }
+        if (fds[1].revents != 0)
+        {
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd != -1)
+            {
+                serve(fd);
+                ::close(fd);
+            }
+        }
+    }
+    ::close(wake_fd);
+}
+
+void MetricsServer::serve(int fd)
+{
+    /* wait (briefly) for the request, to tell an HTTP scraper from a
+     * plain `nc -U`, which gets the text without headers */
+    char request[1024];
+    ssize_t size = 0;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, REQUEST_TIMEOUT) == 1)
+    {
+        size = read(fd, request, sizeof(request) - 1);
+    }
+    bool const http = (size >= 4 && memcmp(request, "GET ", 4) == 0);
+
+    std::string const body = metrics_text();
+    std::string response;
+    if (http)
+    {
+        response =
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "\r\n";
+    }
+    response += body;
+
+    /* a client which doesn't read its answer is given up on */
+    struct timeval timeout = { 1, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char const *data = response.data();
+    size_t left = response.size();
+    while (left > 0)
+    {
+        ssize_t written = send(fd, data, left, MSG_NOSIGNAL);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        data += written;
+        left -= written;
+    }
+}
+
+
+MetricsServer::MetricsServer()
+:   listen_fd(-1),
+    stop_fd(-1),
+    path(),
+    thread()
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    close();
+}
+
@@ -0,0 +1,96 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * metrics.h
+ *
+ *  Process metrics, served in the Prometheus text format on a Unix
+ *  socket.
+ *  The numbers live in the global `metrics`, where the threads which
+ *  own them store them as they change; the server has a thread of its
+ *  own which only ever loads them, so a scrape never waits on (or
+ *  holds up) parsing or rendering.
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+
+/* upper bounds of the frame time histogram's buckets, in seconds */
+static double const METRICS_FRAME_BUCKETS[] =\
+    { 0.001, 0.002, 0.004, 0.008, 0.016, 0.033, 0.066, 0.133 };
+static size_t const METRICS_FRAME_BUCKET_COUNT =\
+    sizeof(METRICS_FRAME_BUCKETS) / sizeof(*METRICS_FRAME_BUCKETS);
+/* sessions whose memory is reported */
+static size_t const METRICS_MAX_SESSIONS = 256;
+
+struct Metrics
+{
+    /* time spent parsing, in nanoseconds (the bytes parsed are in
+     * the parse statistics) */
+    std::atomic<uint64_t> parse_ns;
+    /* bytes waiting to be parsed, and to be written to the host */
+    std::atomic<uint64_t> input_queued,
+                          output_queued;
+    /* time the reader spent waiting for the parser, and the host
+     * spent XOFF'd, in nanoseconds */
+    std::atomic<uint64_t> backpressure_ns,
+                          xoff_ns;
+    /* frames drawn, how long they took in all, and how many took at
+     * most each of METRICS_FRAME_BUCKETS (plus one for the rest) */
+    std::atomic<uint64_t> frames,
+                          frame_ns,
+                          frame_buckets[METRICS_FRAME_BUCKET_COUNT + 1];
+    /* GlyphCache::get found a cache someone was already using, or had
+     * to make one */
+    std::atomic<uint64_t> glyph_cache_hits,
+                          glyph_cache_misses;
+    /* memory used by each of the first `sessions` sessions */
+    std::atomic<uint64_t> sessions,
+                          session_memory[METRICS_MAX_SESSIONS];
+
+    /* count a frame which took ns to draw */
+    void frame(uint64_t ns);
+};
+
+extern Metrics metrics;
+
+
+/* the Prometheus text for the current metrics */
+std::string metrics_text(void);
+
+
+class MetricsServer
+{
+    int listen_fd,
+        /* closed to stop the thread */
+        stop_fd;
+    std::string path;
+    std::thread thread;
+
+    /* accept scrapes until wake_fd is readable */
+    void run_until(int wake_fd);
+    /* answer one scrape */
+    void serve(int fd);
+
+public:
+    /* serve the metrics on a Unix socket at path (replacing a stale
+     * socket there), returns false on error */
+    bool open(std::string const &path);
+    /* stop serving, and remove the socket */
+    void close(void);
+
+    MetricsServer();
+    ~MetricsServer();
+};
+
+
+#endif
+
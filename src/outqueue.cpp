@@ -0,0 +1,103 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * outqueue.cpp
+ *
+ *  Non-blocking output to the host
+ *
+ */
+
+#include "outqueue.h"
+
+#include <sys/uio.h>
+#include <poll.h>
+
+#include <cerrno>
+
+#include <algorithm>
+
+
+
+size_t OutQueue::size() const
+{
+    return ring.size();
+}
+
+size_t OutQueue::enqueue(char const *data, size_t size)
+{
+    size_t n = ring.write(data, size);
+    stats.queued_peak = std::max(stats.queued_peak, ring.size());
+    return n;
+}
+
+ssize_t OutQueue::flush(int fd)
+{
+    if (ring.empty())
+    {
+        return 0;
+    }
+
+    ssize_t written = 0;
+
+    /* only write when the host can take it */
+    struct pollfd fds{};
+    fds.fd = fd;
+    fds.events = POLLOUT;
+    int nfds = poll(&fds, 1, 0);
+    if (nfds == -1)
+    {
+        return -1;
+    }
+    if (fds.revents & (POLLERR | POLLHUP))
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    if (fds.revents & POLLOUT)
+    {
+        struct iovec iov[2];
+        int segments = ring.peek(iov);
+
+        written = writev(fd, iov, segments);
+        if (written == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return -1;
+            }
+            written = 0;
+        }
+        else
+        {
+            ring.consume(written);
+            stats.bytes_written += written;
+            stats.writes++;
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    /* the host didn't take everything, so we're blocked until it does */
+    if (!ring.empty() && !blocked)
+    {
+        blocked = true;
+        blocked_since = now;
+    }
+    else if (ring.empty() && blocked)
+    {
+        blocked = false;
+        stats.blocked_time += now - blocked_since;
+    }
+
+    return written;
+}
+
+
+
+OutQueue::OutQueue()
+:   ring(),
+    blocked_since(),
+    blocked(false),
+    stats{0, 0, 0, std::chrono::nanoseconds(0)}
+{
+}
+
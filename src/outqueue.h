@@ -0,0 +1,57 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * outqueue.h
+ *
+ *  Queue of bytes waiting to be written to the host.
+ *  Writes never block: whatever the host isn't ready for
+ *  stays queued until the next flush.
+ *
+ */
+
+#ifndef _OUTQUEUE_H
+#define _OUTQUEUE_H
+
+
+#include "ringbuffer.h"
+
+#include <sys/types.h>
+
+#include <chrono>
+
+
+class OutQueue
+{
+    RingBuffer<65536> ring;
+
+    /* when the host stopped accepting our output */
+    std::chrono::steady_clock::time_point blocked_since;
+    bool blocked;
+
+public:
+    struct Stats
+    {
+        unsigned long long bytes_written,
+                           writes;
+        size_t queued_peak;
+        /* time output spent waiting on the host */
+        std::chrono::nanoseconds blocked_time;
+    } stats;
+
+    /* number of bytes waiting to be written */
+    size_t size() const;
+
+    /* queue as much of data as fits,
+     * returns the number of bytes queued */
+    size_t enqueue(char const *data, size_t size);
+
+    /* write as much of the queue as the fd will take without blocking
+     * returns the number of bytes written, or -1 on error (check errno) */
+    ssize_t flush(int fd);
+
+
+    OutQueue();
+};
+
+
+#endif
+
@@ -0,0 +1,188 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * parsestats.cpp
+ *
+ *  Counts of what hosts send
+ *
+ */
+
+#include "parsestats.h"
+#include "signalsafe.h"
+
+#include <cstring>
+
+
+/* threads after the first 64 share one set of counters, and may lose
+ * counts to each other */
+static ThreadBlocks<ParseStats, 64> threads;
+static ParseStats overflow;
+
+
+static char const *const state_names[PARSE_STATES] =\
+{
+    "Normal",
+    "Escape",
+    "CtrlSeq",
+    "Pound",
+    "G0SetSelect",
+    "G1SetSelect",
+    "SetUpA",
+    "SetUpB",
+    "CreateAnswerback",
+};
+
+static char const *const sgr_names[6] =\
+{
+    "0", "1", "4", "5", "7", "other"
+};
+
+static char const *const direction_names[2] =\
+{
+    "up", "down"
+};
+
+static char const *const erase_names[3] =\
+{
+    "0", "1", "2"
+};
+
+
+ParseStats *parse_stats_register(void)
+{
+    ParseStats *stats = threads.add();
+    return (stats == nullptr)? &overflow : stats;
+}
+
+static void add_totals(ParseStatsTotals *out, ParseStats const &stats)
+{
+#define X(name, size)                           \
+    for (size_t i = 0; i < size; ++i)           \
+    {                                           \
+        out->name[i] += stats.name[i].get();    \
+    }
+    PARSE_STATS(X)
+#undef X
+}
+
+void parse_stats_totals(ParseStatsTotals *out)
+{
+    memset(out, 0, sizeof(*out));
+    threads.for_each(
+        [out](ParseStats const *stats) { add_totals(out, *stats); });
+    add_totals(out, overflow);
+}
+
+
+
+/* a line of text built up without allocating */
+struct LineBuffer
+{
+    char text[4096];
+    size_t size;
+
+    void append(char const *str)
+    {
+        for (; *str != '\0' && size < sizeof(text); ++str)
+        {
+            text[size++] = *str;
+        }
+    }
+    void append(uint64_t value)
+    {
+        char digits[20];
+        size_t n = 0;
+        do
+        {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value != 0);
+        while (n > 0 && size < sizeof(text))
+        {
+            text[size++] = digits[--n];
+        }
+    }
+};
+
+/* the name of counter idx of a statistic with the given size */
+static void append_label(
+    LineBuffer *line,
+    char const *stat,
+    size_t size,
+    size_t idx)
+{
+    if (size == PARSE_BUCKETS)
+    {
+        /* histogram bucket */
+        if (idx <= 1)
+        {
+            line->append((uint64_t)idx);
+        }
+        else
+        {
+            line->append((uint64_t)1 << (idx - 1));
+            if (idx == PARSE_BUCKETS - 1)
+            {
+                line->append("+");
+            }
+            else
+            {
+                line->append("-");
+                line->append(((uint64_t)1 << idx) - 1);
+            }
+        }
+    }
+    else if (strcmp(stat, "bytes") == 0)
+    {
+        line->append(state_names[idx]);
+    }
+    else if (strcmp(stat, "csi") == 0)
+    {
+        char const final[2] = { (char)(0x40 + idx), '\0' };
+        line->append(final);
+    }
+    else if (strcmp(stat, "sgr") == 0)
+    {
+        line->append(sgr_names[idx]);
+    }
+    else if (strcmp(stat, "scrolls") == 0)
+    {
+        line->append(direction_names[idx]);
+    }
+    else
+    {
+        line->append(erase_names[idx]);
+    }
+}
+
+bool parse_stats_dump(int fd)
+{
+    ParseStatsTotals totals;
+    parse_stats_totals(&totals);
+
+    /* `name: label count label count ...`, leaving out zeroes */
+#define X(name, count)                                  \
+    {                                                   \
+        LineBuffer line;                                \
+        line.size = 0;                                  \
+        line.append(#name ":");                         \
+        for (size_t i = 0; i < count; ++i)              \
+        {                                               \
+            if (totals.name[i] != 0)                    \
+            {                                           \
+                line.append(" ");                       \
+                append_label(&line, #name, count, i);   \
+                line.append(" ");                       \
+                line.append(totals.name[i]);            \
+            }                                           \
+        }                                               \
+        line.append("\n");                              \
+        if (!write_all(fd, line.text, line.size))       \
+        {                                               \
+            return false;                               \
+        }                                               \
+    }
+    PARSE_STATS(X)
+#undef X
+    return true;
+}
+
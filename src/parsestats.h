@@ -0,0 +1,110 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * parsestats.h
+ *
+ *  Counts of what hosts send, kept by every thread which parses.
+ *  Each thread only ever writes its own counters, so a count is a
+ *  relaxed load and store rather than a locked add, and the counters
+ *  can be summed by any thread (or a signal handler) at any time.
+ *
+ */
+
+#ifndef _PARSESTATS_H
+#define _PARSESTATS_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+
+
+/* VT102::State has this many states */
+static size_t const PARSE_STATES = 9;
+/* histograms have a bucket for 0, then one for each power of 2
+ * (1, 2-3, 4-7, ...), the last bucket counting everything above */
+static size_t const PARSE_BUCKETS = 16;
+
+/* every statistic, how many counters it has, and what they're for */
+#define PARSE_STATS(X)                                                  \
+    X(bytes, PARSE_STATES)      /* by parser state */                   \
+    X(csi, 0x7F - 0x40)         /* by final byte, '@' to '~' */         \
+    X(sgr, 6)                   /* by attribute: 0 1 4 5 7 others */    \
+    X(scrolls, 2)               /* up, down */                          \
+    X(scroll_lines, PARSE_BUCKETS)                                      \
+    X(ed, 3)                    /* by parameter */                      \
+    X(ed_cells, PARSE_BUCKETS)                                          \
+    X(el, 3)                    /* by parameter */                      \
+    X(el_cells, PARSE_BUCKETS)                                          \
+    X(printable_run, PARSE_BUCKETS)
+
+
+/* a counter only ever written by one thread */
+struct ParseCounter
+{
+    std::atomic<uint64_t> n;
+
+    void add(uint64_t k)
+    {
+        n.store(n.load(std::memory_order_relaxed) + k,
+                std::memory_order_relaxed);
+    }
+    uint64_t get(void) const
+    {
+        return n.load(std::memory_order_relaxed);
+    }
+};
+
+/* one thread's counters */
+struct ParseStats
+{
+#define X(name, size) ParseCounter name[size];
+    PARSE_STATS(X)
+#undef X
+
+    /* count value in a histogram */
+    static void add(ParseCounter *histogram, uint64_t value)
+    {
+        size_t bucket = (value == 0)
+            ? 0
+            : 64 - __builtin_clzll(value);
+        histogram[(bucket < PARSE_BUCKETS)? bucket : PARSE_BUCKETS - 1]
+            .add(1);
+    }
+};
+
+/* every thread's counters added up */
+struct ParseStatsTotals
+{
+#define X(name, size) uint64_t name[size];
+    PARSE_STATS(X)
+#undef X
+};
+
+
+/* the calling thread's counters, nullptr until it first parses */
+inline thread_local ParseStats *parse_stats_local = nullptr;
+
+/* make counters for the calling thread */
+ParseStats *parse_stats_register(void);
+
+/* the calling thread's counters */
+inline ParseStats &parse_stats(void)
+{
+    if (parse_stats_local == nullptr)
+    {
+        parse_stats_local = parse_stats_register();
+    }
+    return *parse_stats_local;
+}
+
+/* add up every thread's counters */
+void parse_stats_totals(ParseStatsTotals *out);
+
+/* write the totals to fd as text, a line per statistic; it can be
+ * used by a signal handler (see signalsafe.h) */
+bool parse_stats_dump(int fd);
+
+
+#endif
+
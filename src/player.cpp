@@ -0,0 +1,351 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * player.cpp
+ *
+ *  Seekable playback of recordings
+ *
+ */
+
+#include "player.h"
+#include "recorder.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+
+static bool get_varint(
+    uint8_t const **in,
+    uint8_t const *end,
+    uint64_t *value)
+{
+    *value = 0;
+    for (int shift = 0; *in < end && shift < 64; shift += 7)
+    {
+        uint8_t const byte = *(*in)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+bool Player::open(std::string const &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("open(recording)");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat(recording)");
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if (size < sizeof(Recorder::magic) + 1
+        || (data = (uint8_t const *)mmap(
+                nullptr,
+                size,
+                PROT_READ,
+                MAP_PRIVATE,
+                fd,
+                0)) == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: not a recording\n", path.c_str());
+        ::close(fd);
+        data = nullptr;
+        size = 0;
+        return false;
+    }
+    ::close(fd);
+
+    uint8_t const *p = data + sizeof(Recorder::magic),
+                  *end = data + size;
+    uint64_t header_cols,
+             header_rows;
+    version = data[sizeof(Recorder::magic)];
+    ++p;
+    if (memcmp(data, Recorder::magic, sizeof(Recorder::magic)) != 0
+        || version == 0 || version > Recorder::version
+        || !get_varint(&p, end, &header_cols)
+        || !get_varint(&p, end, &header_rows)
+        || header_cols == 0 || header_cols > 65535
+        || header_rows == 0 || header_rows > 65535)
+    {
+        fprintf(stderr, "%s: not a recording\n", path.c_str());
+        close();
+        return false;
+    }
+    cols = header_cols;
+    rows = header_rows;
+    first_frame = p - data;
+
+    /* recordings which weren't closed properly have no index */
+    if (!read_index())
+    {
+        scan();
+    }
+    return true;
+}
+
+void Player::close(void)
+{
+    if (data != nullptr)
+    {
+        munmap((void *)data, size);
+    }
+    data = nullptr;
+    size = 0;
+    first_frame = 0;
+    duration = 0;
+    keyframes.clear();
+}
+
+bool Player::read_frame(size_t offset, Frame *frame) const
+{
+    if (offset >= size)
+    {
+        return false;
+    }
+
+    uint8_t const *p = data + offset,
+                  *end = data + size;
+    uint64_t length;
+    frame->type = *p++;
+    if (!get_varint(&p, end, &frame->delta)
+        || !get_varint(&p, end, &length)
+        || length > (uint64_t)(end - p))
+    {
+        return false;
+    }
+    frame->payload = p;
+    frame->size = length;
+    frame->next = (p - data) + length;
+    return true;
+}
+
+bool Player::read_index(void)
+{
+    size_t const footer = 8 + sizeof(Recorder::index_magic);
+    if (size < first_frame + footer
+        || memcmp(
+            data + size - sizeof(Recorder::index_magic),
+            Recorder::index_magic,
+            sizeof(Recorder::index_magic)) != 0)
+    {
+        return false;
+    }
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        offset |= (uint64_t)data[size - footer + i] << (8 * i);
+    }
+
+    Frame frame;
+    if (offset < first_frame
+        || !read_frame(offset, &frame)
+        || frame.type != Recorder::INDEX)
+    {
+        return false;
+    }
+
+    uint8_t const *p = frame.payload,
+                  *end = frame.payload + frame.size;
+    uint64_t count;
+    if (!get_varint(&p, end, &duration) || !get_varint(&p, end, &count))
+    {
+        return false;
+    }
+    keyframes.clear();
+    for (; count > 0; --count)
+    {
+        Keyframe keyframe;
+        if (!get_varint(&p, end, &keyframe.time)
+            || !get_varint(&p, end, &keyframe.offset))
+        {
+            keyframes.clear();
+            return false;
+        }
+        keyframes.push_back(keyframe);
+    }
+    return true;
+}
+
+void Player::scan(void)
+{
+    keyframes.clear();
+    duration = 0;
+
+    Frame frame;
+    for (size_t offset = first_frame;
+         read_frame(offset, &frame) && frame.type != Recorder::INDEX;
+         offset = frame.next)
+    {
+        duration += frame.delta;
+        if (frame.type == Recorder::KEYFRAME)
+        {
+            keyframes.push_back(Keyframe{duration, offset});
+        }
+    }
+}
+
+bool Player::seek(VT102 *term, uint64_t time, SeekStats *stats) const
+{
+    SeekStats local;
+    if (stats == nullptr)
+    {
+        stats = &local;
+    }
+    *stats = SeekStats{0, false, 0, 0};
+
+    if (data == nullptr)
+    {
+        return false;
+    }
+
+    /* the last keyframe at or before time */
+    auto const next = std::upper_bound(
+        keyframes.begin(),
+        keyframes.end(),
+        time,
+        [](uint64_t t, Keyframe const &keyframe)
+        {
+            return t < keyframe.time;
+        });
+
+    uint64_t position = 0,      /* of the next output byte */
+             skip = 0,          /* output already in the keyframe */
+             keyframe_offset = 0,
+             now = 0;
+    size_t offset = first_frame;
+    bool first = false;
+
+    if (next != keyframes.begin())
+    {
+        Keyframe const &keyframe = *(next - 1);
+        Frame frame;
+        if (!read_frame(keyframe.offset, &frame)
+            || frame.type != Recorder::KEYFRAME)
+        {
+            return false;
+        }
+
+        uint8_t const *p = frame.payload,
+                      *end = frame.payload + frame.size;
+        uint64_t resume_offset;
+        if (!get_varint(&p, end, &skip)
+            || !get_varint(&p, end, &resume_offset)
+            || !get_varint(&p, end, &position)
+            || !get_varint(&p, end, &now)
+            || resume_offset < first_frame)
+        {
+            return false;
+        }
+        term->deserialize(p, end - p);
+
+        offset = resume_offset;
+        keyframe_offset = keyframe.offset;
+        first = true;
+        stats->keyframe_time = keyframe.time;
+        stats->from_keyframe = true;
+    }
+    else
+    {
+        /* start again from a new terminal */
+        VT102 fresh{};
+        fresh.resize(cols, rows);
+        std::string snapshot;
+        fresh.serialize(&snapshot);
+        term->deserialize((uint8_t const *)snapshot.data(), snapshot.size());
+    }
+
+    Frame frame;
+    for (; read_frame(offset, &frame); offset = frame.next)
+    {
+        /* the first frame replayed after a keyframe has its time in
+         * the keyframe, rather than relative to the frame before */
+        if (!first)
+        {
+            now += frame.delta;
+        }
+        first = false;
+        if (now > time || frame.type == Recorder::INDEX)
+        {
+            break;
+        }
+        stats->frames += 1;
+
+        switch (frame.type)
+        {
+        case Recorder::OUTPUT:
+        {
+            /* the start of this frame may already be in the keyframe */
+            uint64_t const from = (skip > position)
+                ? std::min<uint64_t>(skip - position, frame.size)
+                : 0;
+            term->interpret_bytes(frame.payload + from, frame.size - from);
+            stats->bytes += frame.size - from;
+            position += frame.size;
+        } break;
+
+        case Recorder::RESIZE:
+        {
+            /* resizes before the keyframe are already in it */
+            uint8_t const *p = frame.payload,
+                          *end = frame.payload + frame.size;
+            uint64_t new_cols,
+                     new_rows;
+            if (offset > keyframe_offset
+                && get_varint(&p, end, &new_cols)
+                && get_varint(&p, end, &new_rows)
+                && new_cols > 0 && new_cols <= 65535
+                && new_rows > 0 && new_rows <= 65535)
+            {
+                term->resize(new_cols, new_rows);
+            }
+        } break;
+
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+
+
+Player::Player()
+:   version(0),
+    cols(0),
+    rows(0),
+    duration(0),
+    keyframes(),
+    data(nullptr),
+    size(0),
+    first_frame(0)
+{
+}
+
+Player::~Player()
+{
+    close();
+}
+
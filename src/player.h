@@ -0,0 +1,90 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * player.h
+ *
+ *  Seekable playback of recordings made by Recorder.
+ *  Seeking restores the nearest keyframe at or before the target and
+ *  replays only the output recorded after it, so the cost doesn't
+ *  grow with the length of the recording.
+ *
+ */
+
+#ifndef _PLAYER_H
+#define _PLAYER_H
+
+
+#include "vt102.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <vector>
+
+
+class Player
+{
+public:
+    struct Keyframe
+    {
+        uint64_t time,      /* microseconds since the start */
+                 offset;    /* of the KEYFRAME frame */
+    };
+
+    /* what the last seek had to do */
+    struct SeekStats
+    {
+        uint64_t keyframe_time;     /* restored keyframe, or 0 */
+        bool from_keyframe;
+        unsigned long long frames,  /* frames read after it */
+                           bytes;   /* output bytes replayed */
+    };
+
+    uint8_t version;
+    int cols,
+        rows;
+    /* length of the recording, in microseconds */
+    uint64_t duration;
+    std::vector<Keyframe> keyframes;
+
+    /* map a recording, returns false on error */
+    bool open(std::string const &path);
+    void close(void);
+
+    /* bring term to its state time microseconds into the recording,
+     * returns false if the recording is damaged; throws
+     * std::runtime_error if a keyframe is malformed */
+    bool seek(VT102 *term, uint64_t time, SeekStats *stats=nullptr) const;
+
+
+    Player();
+    Player(Player const &other) = delete;
+    Player &operator=(Player const &other) = delete;
+    ~Player();
+
+private:
+    struct Frame
+    {
+        uint8_t type;
+        uint64_t delta;
+        uint8_t const *payload;
+        size_t size,
+               next;    /* offset of the following frame */
+    };
+
+    uint8_t const *data;
+    size_t size,
+           first_frame;
+
+    /* read the frame at offset, returns false at the end of the
+     * recording or if it's cut short */
+    bool read_frame(size_t offset, Frame *frame) const;
+    /* read the index written when the recording was closed */
+    bool read_index(void);
+    /* find the keyframes by walking every frame */
+    void scan(void);
+};
+
+
+#endif
+
@@ -0,0 +1,126 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * pty.cpp
+ *
+ *  Running programs on a pseudoterminal
+ *
+ */
+
+/* for posix_openpt, ptsname, grantpt and unlockpt */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE   600
+#endif
+
+#include "pty.h"
+
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+
+
+
+pid_t spawn_pty(
+    char *const argv[],
+    int cols,
+    int rows,
+    int *master,
+    std::string *slave_name)
+{
+    /* open the pseudoterminal master fd; it's close-on-exec, so the
+     * sessions started later don't hold it open (the slave would
+     * never see it hang up) */
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    char const *const slave_filename = ptsname(fd);
+    if (    slave_filename == nullptr
+        ||  grantpt(fd) == -1
+        ||  unlockpt(fd) == -1)
+    {
+        int errno_backup = errno;
+        close(fd);
+        errno = errno_backup;
+        return -1;
+    }
+    *slave_name = slave_filename;
+
+    /* the slave is opened before forking, so it's never closed while
+     * the child starts up (which would hang up the master); the
+     * child's dup2s of it aren't close-on-exec */
+    int slave = open(slave_filename, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave == -1)
+    {
+        int errno_backup = errno;
+        close(fd);
+        errno = errno_backup;
+        return -1;
+    }
+
+    struct winsize _winsize{};
+    _winsize.ws_col = cols;
+    _winsize.ws_row = rows;
+    if (ioctl(slave, TIOCSWINSZ, &_winsize) == -1)
+    {
+        perror("ioctl(TIOCSWINSZ)");
+    }
+
+
+    pid_t pid = fork();
+    /* child */
+    if (pid == 0)
+    {
+        close(fd);
+
+        /* create new session */
+        setsid();
+
+        /* make the tty a controlling tty of the calling process */
+        if (ioctl(slave, TIOCSCTTY, nullptr) == -1)
+        {
+            perror("ioctl(TIOCSCTTY)");
+            _exit(EXIT_FAILURE);
+        }
+
+        /* rebind stdin, stdout, and stderr to slave */
+        dup2(slave, 0);
+        dup2(slave, 1);
+        dup2(slave, 2);
+        close(slave);
+
+        if (putenv((char *)"TERM=vt102") != 0)
+        {
+            perror("putenv");
+            _exit(EXIT_FAILURE);
+        }
+        execvp(argv[0], argv);
+        perror("execvp");
+        _exit(EXIT_FAILURE);
+    }
+    /* fork() parent */
+    close(slave);
+    if (pid == -1)
+    {
+        int errno_backup = errno;
+        close(fd);
+        errno = errno_backup;
+        return -1;
+    }
+
+    /* output to the child must never block us */
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        perror("fcntl(master)");
+    }
+
+    *master = fd;
+    return pid;
+}
+
@@ -0,0 +1,32 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * pty.h
+ *
+ *  Running programs on a pseudoterminal
+ *
+ */
+
+#ifndef _PTY_H
+#define _PTY_H
+
+
+#include <sys/types.h>
+
+#include <string>
+
+
+/* run argv on the slave side of a new pseudoterminal of the given size,
+ * with TERM=vt102
+ *  the master fd is put in *master, and is non-blocking
+ *  the slave's filename is put in *slave_name
+ *  returns the child's pid, or -1 on error (with errno set) */
+pid_t spawn_pty(
+    char *const argv[],
+    int cols,
+    int rows,
+    int *master,
+    std::string *slave_name);
+
+
+#endif
+
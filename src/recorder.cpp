@@ -0,0 +1,360 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * recorder.cpp
+ *
+ *  Session recording
+ *
+ */
+
+#include "recorder.h"
+
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+
+/* enough for many reads' worth of output, so a flood costs one write
+ * per buffer rather than one per read */
+static size_t const BUFFER_SIZE = 256 << 10;
+/* longest possible frame header */
+static size_t const MAX_HEADER = 1 + 10 + 10;
+
+constexpr char const Recorder::magic[8];
+constexpr char const Recorder::index_magic[8];
+
+
+static size_t put_varint(uint8_t *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+
+
+bool Recorder::open(std::string const &path, int cols, int rows)
+{
+    close();
+
+    std::lock_guard<std::mutex> guard(lock);
+    fd = ::open(
+        path.c_str(),
+        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0600);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    memcpy(buffer.data(), magic, sizeof(magic));
+    buffered = sizeof(magic);
+    buffer[buffered++] = version;
+    buffered += put_varint(buffer.data() + buffered, cols);
+    buffered += put_varint(buffer.data() + buffered, rows);
+    start = std::chrono::steady_clock::now();
+    last_keyframe = start;
+    last_time = 0;
+    output_bytes = 0;
+    pending.clear();
+    keyframes.clear();
+    return true;
+}
+
+bool Recorder::is_open(void) const
+{
+    return fd != -1;
+}
+
+void Recorder::output(void const *data, size_t size)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd == -1 || size == 0)
+    {
+        return;
+    }
+
+    /* remember where it went until it's been parsed, for keyframes */
+    uint64_t const offset = stats.file_bytes + buffered;
+    frame(OUTPUT, data, size, std::chrono::steady_clock::now());
+    if (fd != -1)
+    {
+        pending.push_back(
+            Pending{output_bytes, output_bytes + size, offset, last_time});
+    }
+    output_bytes += size;
+}
+
+void Recorder::input(void const *data, size_t size)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    frame(INPUT, data, size, std::chrono::steady_clock::now());
+}
+
+void Recorder::resize(int cols, int rows)
+{
+    uint8_t payload[20];
+    size_t size = put_varint(payload, cols);
+    size += put_varint(payload + size, rows);
+
+    std::lock_guard<std::mutex> guard(lock);
+    frame(RESIZE, payload, size, std::chrono::steady_clock::now());
+}
+
+void Recorder::parsed(uint64_t position)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    prune(position);
+}
+
+void Recorder::prune(uint64_t position)
+{
+    while (!pending.empty() && pending.front().end <= position)
+    {
+        pending.pop_front();
+    }
+}
+
+void Recorder::keyframe(uint64_t position, std::string const &snapshot)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    auto const now = std::chrono::steady_clock::now();
+    uint64_t const offset = stats.file_bytes + buffered,
+                   time = std::max<uint64_t>(
+                       last_time,
+                       std::chrono::duration_cast<std::chrono::microseconds>(
+                           now - start).count());
+
+    /* replay resumes at the first output that wasn't parsed yet, or
+     * just after the keyframe if everything was */
+    prune(position);
+    Pending const resume = pending.empty()
+        ? Pending{output_bytes, output_bytes, offset, time}
+        : pending.front();
+
+    uint8_t head[40];
+    size_t size = put_varint(head, position);
+    size += put_varint(head + size, resume.offset);
+    size += put_varint(head + size, resume.start);
+    size += put_varint(head + size, resume.time);
+
+    std::string payload;
+    payload.reserve(size + snapshot.size());
+    payload.append((char const *)head, size);
+    payload.append(snapshot);
+
+    frame(KEYFRAME, payload.data(), payload.size(), now);
+    if (fd != -1)
+    {
+        keyframes.push_back(IndexEntry{last_time, offset});
+        stats.keyframes += 1;
+    }
+    last_keyframe = now;
+}
+
+bool Recorder::keyframe_due(std::chrono::steady_clock::duration interval) const
+{
+    return fd != -1
+        && std::chrono::steady_clock::now() - last_keyframe >= interval;
+}
+
+void Recorder::frame(
+    FrameType type,
+    void const *payload,
+    size_t size,
+    std::chrono::steady_clock::time_point now)
+{
+    if (fd == -1 || size == 0)
+    {
+        return;
+    }
+
+    /* make room for the frame, or just its header if it's too big to
+     * buffer anyway */
+    bool const fits = (MAX_HEADER + size <= buffer.size());
+    if (buffered + MAX_HEADER + (fits? size : 0) > buffer.size())
+    {
+        if (!write_out(nullptr, 0))
+        {
+            return;
+        }
+    }
+
+    /* times are kept as whole microseconds since the start, so the
+     * deltas add up exactly */
+    uint64_t const time = std::max<uint64_t>(
+        last_time,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            now - start).count());
+    buffer[buffered++] = type;
+    buffered += put_varint(buffer.data() + buffered, time - last_time);
+    buffered += put_varint(buffer.data() + buffered, size);
+    last_time = time;
+
+    if (buffered + size <= buffer.size())
+    {
+        memcpy(buffer.data() + buffered, payload, size);
+        buffered += size;
+    }
+    /* too big to buffer: the buffer and payload go out in one writev */
+    else if (!write_out(payload, size))
+    {
+        return;
+    }
+
+    stats.frames += 1;
+    stats.payload_bytes += size;
+    stats.time += std::chrono::steady_clock::now() - now;
+}
+
+bool Recorder::write_out(void const *data, size_t size)
+{
+    struct iovec iov[2];
+    iov[0].iov_base = buffer.data();
+    iov[0].iov_len = buffered;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = size;
+
+    struct iovec *next = iov;
+    int count = 2;
+    while (count > 0)
+    {
+        if (next->iov_len == 0)
+        {
+            ++next;
+            --count;
+            continue;
+        }
+
+        ssize_t written = writev(fd, next, count);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fail("writev(recording)");
+            return false;
+        }
+        stats.file_bytes += written;
+        stats.writes += 1;
+
+        /* skip over whatever was written */
+        for (; count > 0 && (size_t)written >= next->iov_len; ++next, --count)
+        {
+            written -= next->iov_len;
+        }
+        if (count > 0)
+        {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    buffered = 0;
+    return true;
+}
+
+void Recorder::flush(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd != -1 && buffered != 0)
+    {
+        auto const start = std::chrono::steady_clock::now();
+        write_out(nullptr, 0);
+        stats.time += std::chrono::steady_clock::now() - start;
+    }
+}
+
+void Recorder::fail(char const *what)
+{
+    /* give up on the recording, rather than the session */
+    perror(what);
+    ::close(fd);
+    fd = -1;
+    buffered = 0;
+}
+
+void Recorder::close(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (fd == -1)
+    {
+        return;
+    }
+
+    /* index the keyframes, so a player can find them without reading
+     * the whole recording */
+    auto const now = std::chrono::steady_clock::now();
+    std::string index;
+    uint8_t varint[10];
+    index.append((char const *)varint, put_varint(varint, last_time));
+    index.append(
+        (char const *)varint,
+        put_varint(varint, keyframes.size()));
+    for (IndexEntry const &entry : keyframes)
+    {
+        index.append((char const *)varint, put_varint(varint, entry.time));
+        index.append((char const *)varint, put_varint(varint, entry.offset));
+    }
+
+    uint64_t const offset = stats.file_bytes + buffered;
+    frame(INDEX, index.data(), index.size(), now);
+
+    if (fd != -1)
+    {
+        uint8_t footer[16];
+        for (size_t i = 0; i < 8; ++i)
+        {
+            footer[i] = offset >> (8 * i);
+        }
+        memcpy(footer + 8, index_magic, sizeof(index_magic));
+        write_out(footer, sizeof(footer));
+    }
+
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    pending.clear();
+    keyframes.clear();
+}
+
+
+
+Recorder::Recorder()
+:   stats{0, 0, 0, 0, 0, std::chrono::nanoseconds(0)},
+    lock(),
+    fd(-1),
+    start(),
+    last_keyframe(),
+    last_time(0),
+    output_bytes(0),
+    pending(),
+    keyframes(),
+    buffer(BUFFER_SIZE),
+    buffered(0)
+{
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
@@ -0,0 +1,143 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * recorder.h
+ *
+ *  Session recording.
+ *  A recording is a header followed by frames:
+ *      header  "VT102REC", 1 byte version, varint cols, varint rows
+ *      frame   1 byte type, varint microseconds since the last frame,
+ *              varint payload size, payload
+ *  where the payloads are
+ *      OUTPUT, INPUT   the bytes
+ *      RESIZE          varint cols, varint rows
+ *      KEYFRAME        varint position, varint resume offset,
+ *                      varint resume position, varint resume time,
+ *                      VT102 snapshot
+ *      INDEX           varint duration, varint count,
+ *                      count * (varint time, varint offset)
+ *  A keyframe is the terminal's state once position bytes of OUTPUT had
+ *  been parsed. Output is recorded as it's read, before it's parsed, so
+ *  the keyframe also says where the first unparsed OUTPUT frame is: its
+ *  file offset, its position in the output, and its time.
+ *  A finished recording ends with an INDEX of the keyframes, then the
+ *  8 byte offset of the INDEX frame and "VT102IDX".
+ *  Varints are little-endian base 128, times are in microseconds since
+ *  the start, offsets in bytes from the start of the file.
+ *
+ */
+
+#ifndef _RECORDER_H
+#define _RECORDER_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+class Recorder
+{
+public:
+    enum FrameType : uint8_t
+    {
+        OUTPUT,     /* from the host */
+        INPUT,      /* to the host */
+        RESIZE,
+        KEYFRAME,
+        INDEX,
+    };
+
+    static constexpr char const magic[8] = {'V','T','1','0','2','R','E','C'};
+    static constexpr char const index_magic[8] =\
+        {'V','T','1','0','2','I','D','X'};
+    static uint8_t const version = 2;
+
+    struct Stats
+    {
+        unsigned long long frames,
+                           payload_bytes,   /* bytes recorded */
+                           file_bytes,      /* bytes written */
+                           writes,
+                           keyframes;
+        /* time spent recording, including writes */
+        std::chrono::nanoseconds time;
+    } stats;
+
+    /* start recording to path, returns false on error */
+    bool open(std::string const &path, int cols, int rows);
+    bool is_open(void) const;
+
+    /* record a frame, safe to call from any thread */
+    void output(void const *data, size_t size);
+    void input(void const *data, size_t size);
+    void resize(int cols, int rows);
+
+    /* the first position bytes of output have been parsed */
+    void parsed(uint64_t position);
+    /* record the terminal's state after parsing position bytes */
+    void keyframe(uint64_t position, std::string const &snapshot);
+    bool keyframe_due(std::chrono::steady_clock::duration interval) const;
+
+    /* write out buffered frames */
+    void flush(void);
+    /* write the index and finish the recording */
+    void close(void);
+
+
+    Recorder();
+    Recorder(Recorder const &other) = delete;
+    Recorder &operator=(Recorder const &other) = delete;
+    ~Recorder();
+
+private:
+    /* an OUTPUT frame which hasn't been parsed yet */
+    struct Pending
+    {
+        uint64_t start,     /* position of its first byte */
+                 end,
+                 offset,    /* file offset of the frame */
+                 time;
+    };
+    /* a keyframe, for the index */
+    struct IndexEntry
+    {
+        uint64_t time,
+                 offset;
+    };
+
+    std::mutex lock;
+    int fd;
+    std::chrono::steady_clock::time_point start,
+                                          last_keyframe;
+    uint64_t last_time,     /* time of the last frame */
+             output_bytes;  /* OUTPUT bytes recorded */
+    std::deque<Pending> pending;
+    std::vector<IndexEntry> keyframes;
+
+    /* frames are gathered here, and written out when it fills up and
+     * on flush(); only a payload bigger than all of it is written
+     * straight from the caller's buffer */
+    std::vector<uint8_t> buffer;
+    size_t buffered;
+
+    /* record a frame which happened at now, lock must be held */
+    void frame(
+        FrameType type,
+        void const *payload,
+        size_t size,
+        std::chrono::steady_clock::time_point now);
+    /* write the buffer and then data, lock must be held */
+    bool write_out(void const *data, size_t size);
+    void fail(char const *what);
+    /* drop the OUTPUT frames parsed by position, lock must be held */
+    void prune(uint64_t position);
+};
+
+
+#endif
+
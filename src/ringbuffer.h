@@ -0,0 +1,148 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * ringbuffer.h
+ *
+ *  Fixed-size byte ring.
+ *  Safe for one producer thread and one consumer thread
+ *  without locking.
+ *
+ */
+
+#ifndef _RINGBUFFER_H
+#define _RINGBUFFER_H
+
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstring>
+
+#include <atomic>
+#include <algorithm>
+
+
+template<size_t N>
+class RingBuffer
+{
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of 2");
+
+    char data[N];
+
+    /* head and tail only ever increase, the buffer index is
+     * taken modulo N */
+    std::atomic<size_t> head,   /* next byte to read */
+                        tail;   /* next byte to write */
+
+public:
+    static constexpr size_t capacity = N;
+
+    /* number of bytes waiting to be read */
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire)
+             - head.load(std::memory_order_acquire);
+    }
+
+    /* number of bytes which can be written */
+    size_t space() const
+    {
+        return N - size();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /* append up to n bytes, returns the number of bytes written */
+    size_t write(void const *in, size_t n)
+    {
+        size_t const t = tail.load(std::memory_order_relaxed);
+        n = std::min(n, N - (t - head.load(std::memory_order_acquire)));
+
+        size_t const idx = t % N,
+                     first = std::min(n, N - idx);
+        memcpy(data + idx, in, first);
+        memcpy(data, (char const *)in + first, n - first);
+
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    /* get the readable bytes as (at most) 2 contiguous segments,
+     * returns the number of segments used */
+    int peek(struct iovec iov[2]) const
+    {
+        size_t const h = head.load(std::memory_order_relaxed),
+                     n = tail.load(std::memory_order_acquire) - h,
+                     idx = h % N,
+                     first = std::min(n, N - idx);
+
+        iov[0].iov_base = (void *)(data + idx);
+        iov[0].iov_len = first;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = n - first;
+
+        return (n == 0)? 0 : (n == first)? 1 : 2;
+    }
+
+    /* get the free space as (at most) 2 contiguous segments, so it can
+     * be filled in place (eg. with readv), returns the number of
+     * segments used */
+    int reserve(struct iovec iov[2])
+    {
+        size_t const t = tail.load(std::memory_order_relaxed),
+                     n = N - (t - head.load(std::memory_order_acquire)),
+                     idx = t % N,
+                     first = std::min(n, N - idx);
+
+        iov[0].iov_base = (void *)(data + idx);
+        iov[0].iov_len = first;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = n - first;
+
+        return (n == 0)? 0 : (n == first)? 1 : 2;
+    }
+
+    /* add n bytes written in place after reserve() to the ring */
+    void commit(size_t n)
+    {
+        tail.store(
+            tail.load(std::memory_order_relaxed) + n,
+            std::memory_order_release);
+    }
+
+    /* drop n bytes from the front of the ring */
+    void consume(size_t n)
+    {
+        head.store(
+            head.load(std::memory_order_relaxed) + n,
+            std::memory_order_release);
+    }
+
+    /* read up to n bytes, returns the number of bytes read */
+    size_t read(void *out, size_t n)
+    {
+        struct iovec iov[2];
+        peek(iov);
+        n = std::min(n, iov[0].iov_len + iov[1].iov_len);
+
+        size_t const first = std::min(n, iov[0].iov_len);
+        memcpy(out, iov[0].iov_base, first);
+        memcpy((char *)out + first, iov[1].iov_base, n - first);
+
+        consume(n);
+        return n;
+    }
+
+
+    RingBuffer()
+    :   head(0),
+        tail(0)
+    {
+    }
+};
+
+
+#endif
+
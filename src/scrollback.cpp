@@ -0,0 +1,645 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * scrollback.cpp
+ *
+ *  Compact scrollback ring
+ *
+ */
+
+#include "scrollback.h"
+#include "vt102.h"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+
+
+/* an encoded line is laid out as
+ *  attr        1 byte
+ *  length      2 bytes, number of cells up to the last non-blank one
+ *  runs        2 bytes, number of attribute runs
+ *  run[runs]   3 bytes each: 2 byte cell count, 1 byte of flags
+ *  ch[length]  1 byte each
+ * with the multi-byte fields little-endian */
+static size_t const HEADER_SIZE = 5,
+                    RUN_SIZE = 3;
+
+/* spill file chunk sizes, the segment chunk must hold the biggest
+ * possible line */
+static size_t const SEGMENT_CHUNK = 4 << 20,
+                    INDEX_CHUNK = 1 << 20;
+/* index entry for a blank line */
+static uint64_t const BLANK = UINT64_MAX;
+
+/* run flags */
+enum
+{
+    F_UNDERLINE = 1 << 0,
+    F_REVERSE   = 1 << 1,
+    F_BLINK     = 1 << 2,
+    F_BOLD      = 1 << 3,
+    /* the charset goes in the high bits */
+    F_CHARSET_SHIFT = 4,
+};
+
+
+static uint8_t flags(Char const &chr)
+{
+    return (chr.underline? F_UNDERLINE : 0)
+         | (chr.reverse? F_REVERSE : 0)
+         | (chr.blink? F_BLINK : 0)
+         | (chr.bold? F_BOLD : 0)
+         | ((uint8_t)chr.charset << F_CHARSET_SHIFT);
+}
+
+/* a cell which looks the same as an erased one */
+static bool is_blank(Char const &chr)
+{
+    return chr.ch == ' '
+        && !chr.underline
+        && !chr.reverse
+        && chr.glyph == VT102::fontidx(CharSet::UnitedStates, ' ');
+}
+
+static void put16(uint8_t *out, size_t value)
+{
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+}
+
+static size_t get16(uint8_t const *in)
+{
+    return in[0] | (in[1] << 8);
+}
+
+
+
+Scrollback::Encoded Scrollback::encode(Line const &line, size_t *size)
+{
+    /* trailing blanks aren't stored */
+    size_t length = std::min<size_t>(line.chars.size(), 0xffff);
+    while (length > 0 && is_blank(line.chars[length - 1]))
+    {
+        length -= 1;
+    }
+    if (length == 0 && line.attr == Line::NORMAL)
+    {
+        *size = 0;
+        return nullptr;
+    }
+
+    size_t runs = 0;
+    for (size_t x = 0; x < length; ++x)
+    {
+        if (x == 0 || flags(line.chars[x]) != flags(line.chars[x - 1]))
+        {
+            runs += 1;
+        }
+    }
+
+    *size = HEADER_SIZE + (runs * RUN_SIZE) + length;
+    Encoded encoded(new uint8_t[*size]);
+    uint8_t *out = encoded.get();
+
+    out[0] = line.attr;
+    put16(out + 1, length);
+    put16(out + 3, runs);
+
+    uint8_t *run = out + HEADER_SIZE,
+            *chars = run + (runs * RUN_SIZE);
+    size_t count = 0;
+    for (size_t x = 0; x < length; ++x)
+    {
+        Char const &chr = line.chars[x];
+        chars[x] = chr.ch;
+
+        count += 1;
+        if (x + 1 == length || flags(line.chars[x + 1]) != flags(chr))
+        {
+            put16(run, count);
+            run[2] = flags(chr);
+            run += RUN_SIZE;
+            count = 0;
+        }
+    }
+
+    return encoded;
+}
+
+size_t Scrollback::encoded_size(uint8_t const *encoded)
+{
+    return (encoded == nullptr)
+        ? 0
+        : HEADER_SIZE
+            + (get16(encoded + 3) * RUN_SIZE)
+            + get16(encoded + 1);
+}
+
+void Scrollback::push(Line const &line)
+{
+    size_t size = 0;
+    Encoded encoded = encode(line, &size);
+    bytes += size;
+
+    uint8_t const *chars = nullptr;
+    size_t const length = text(encoded.get(), &chars);
+    text_index.add(pushed, chars, length);
+    pushed += 1;
+
+    if (lines.size() < max_lines)
+    {
+        lines.push_back(std::move(encoded));
+    }
+    else
+    {
+        /* replace the oldest line */
+        std::swap(lines[first], encoded);
+        first = (first + 1) % max_lines;
+        bytes -= encoded_size(encoded.get());
+        evict(std::move(encoded));
+    }
+
+    /* once a ring's worth of lines has left the ring, take them out
+     * of the index too, so it's no bigger than the ring; spilled ones
+     * keep theirs, on disk */
+    uint64_t const oldest =\
+        (pushed - lines.size()) / TrigramIndex::block_lines;
+    if (oldest >= pruned + std::max<size_t>(
+            max_lines / TrigramIndex::block_lines, 1))
+    {
+        if (frozen_fd != -1)
+        {
+            std::vector<uint8_t> part;
+            text_index.prune(oldest, &part);
+            freeze(part, oldest);
+        }
+        else
+        {
+            text_index.prune(oldest);
+        }
+        pruned = oldest;
+    }
+}
+
+void Scrollback::freeze(std::vector<uint8_t> const &part, uint64_t end)
+{
+    /* parts are mapped on their own */
+    uint64_t const page = sysconf(_SC_PAGESIZE),
+                   offset = (frozen_size + page - 1) / page * page;
+    if (pwrite(frozen_fd, part.data(), part.size(), offset)
+            != (ssize_t)part.size())
+    {
+        /* the lines it would have covered are searched one by one */
+        perror("scrollback index spill");
+        close_frozen();
+        return;
+    }
+    frozen.push_back(FrozenPart{offset, part.size(), end});
+    frozen_size = offset + part.size();
+}
+
+void Scrollback::close_frozen(void)
+{
+    if (frozen_fd != -1)
+    {
+        close(frozen_fd);
+        frozen_fd = -1;
+    }
+    frozen.clear();
+    frozen_size = 0;
+}
+
+void Scrollback::evict(Encoded encoded)
+{
+    if (segment.fd == -1 || index.fd == -1)
+    {
+        return;
+    }
+
+    uint64_t offset = BLANK;
+    if (    (   encoded != nullptr
+             && !segment.append(
+                    encoded.get(),
+                    encoded_size(encoded.get()),
+                    &offset))
+        ||  !index.append(&offset, sizeof(offset), nullptr))
+    {
+        /* keep what's been spilled so far, but stop spilling */
+        perror("scrollback spill");
+        segment.close();
+        index.close();
+        return;
+    }
+    spilled += 1;
+}
+
+Line Scrollback::decode(uint8_t const *in, size_t cols)
+{
+    Char const blank =\
+    {
+        ' ', false, false, false, false, CharSet::UnitedStates,
+        (uint8_t)VT102::fontidx(CharSet::UnitedStates, ' ')
+    };
+    Line line{Line::NORMAL, std::vector<Char>(cols, blank)};
+
+    if (in == nullptr)
+    {
+        return line;
+    }
+
+    /* the runs cover every stored cell */
+    line.attr = (Line::Attr)in[0];
+    size_t const runs = get16(in + 3);
+    uint8_t const *run = in + HEADER_SIZE,
+                  *chars = run + (runs * RUN_SIZE);
+
+    size_t x = 0;
+    for (size_t r = 0; r < runs && x < cols; ++r, run += RUN_SIZE)
+    {
+        uint8_t const f = run[2];
+        CharSet const charset = (CharSet)(f >> F_CHARSET_SHIFT);
+        for (size_t n = get16(run); n > 0 && x < cols; --n, ++x)
+        {
+            Char &chr = line.chars[x];
+            chr.ch = chars[x];
+            chr.underline = f & F_UNDERLINE;
+            chr.reverse = f & F_REVERSE;
+            chr.blink = f & F_BLINK;
+            chr.bold = f & F_BOLD;
+            chr.charset = charset;
+            chr.glyph = VT102::fontidx(charset, chr.ch);
+        }
+    }
+
+    return line;
+}
+
+size_t Scrollback::text(uint8_t const *encoded, uint8_t const **chars)
+{
+    if (encoded == nullptr)
+    {
+        return 0;
+    }
+    *chars = encoded + HEADER_SIZE + (get16(encoded + 3) * RUN_SIZE);
+    return get16(encoded + 1);
+}
+
+uint8_t const *Scrollback::at(size_t idx) const
+{
+    /* spilled lines are paged in from the segment file */
+    if (idx < spilled)
+    {
+        uint64_t offset;
+        memcpy(&offset, index.at(idx * sizeof(offset)), sizeof(offset));
+        return (offset == BLANK)? nullptr : segment.at(offset);
+    }
+
+    idx -= spilled;
+    return lines.at((first + idx) % lines.size()).get();
+}
+
+Line Scrollback::get(size_t idx, size_t cols) const
+{
+    return decode(at(idx), cols);
+}
+
+bool Scrollback::find(
+    uint8_t const *chars,
+    size_t size,
+    std::string const &needle,
+    bool ignore_case,
+    size_t line,
+    size_t max_hits,
+    std::vector<Hit> *hits)
+{
+    auto const equal = [ignore_case](uint8_t a, char b)
+    {
+        return ignore_case
+            ? tolower(a) == tolower((uint8_t)b)
+            : a == (uint8_t)b;
+    };
+
+    if (needle.empty())
+    {
+        return true;
+    }
+
+    uint8_t const *const end = chars + size;
+    for (uint8_t const *pos = chars;;)
+    {
+        if (hits->size() >= max_hits)
+        {
+            return false;
+        }
+        pos = std::search(pos, end, needle.begin(), needle.end(), equal);
+        if (pos == end)
+        {
+            return true;
+        }
+        hits->push_back(Hit{line, (size_t)(pos - chars)});
+        pos += 1;
+    }
+}
+
+void Scrollback::search(
+    std::string const &needle,
+    bool ignore_case,
+    size_t max_hits,
+    std::vector<Hit> *hits) const
+{
+    if (needle.empty())
+    {
+        return;
+    }
+
+    uint64_t const dropped = pushed - size();
+    auto const search_line = [&](size_t idx)
+    {
+        uint8_t const *chars = nullptr;
+        size_t const length = text(at(idx), &chars);
+        return find(chars, length, needle, ignore_case, idx, max_hits, hits);
+    };
+    auto const search_blocks = [&](std::vector<uint64_t> const &blocks)
+    {
+        for (uint64_t block : blocks)
+        {
+            uint64_t const start = std::max<uint64_t>(
+                               block * TrigramIndex::block_lines,
+                               dropped),
+                           end = std::min<uint64_t>(
+                               (block + 1) * TrigramIndex::block_lines,
+                               pushed);
+            for (uint64_t line = start; line < end; ++line)
+            {
+                if (!search_line(line - dropped))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    std::vector<uint64_t> blocks;
+    if (!text_index.candidates(needle, &blocks))
+    {
+        /* too short to look up, check everything */
+        for (size_t idx = 0; idx < size(); ++idx)
+        {
+            if (!search_line(idx))
+            {
+                return;
+            }
+        }
+        return;
+    }
+
+    /* the spilled lines, through the frozen index */
+    std::vector<uint64_t> frozen_blocks;
+    for (FrozenPart const &part : frozen)
+    {
+        void *mapped = mmap(
+            nullptr,
+            part.size,
+            PROT_READ,
+            MAP_SHARED,
+            frozen_fd,
+            part.offset);
+        if (mapped == MAP_FAILED)
+        {
+            perror("mmap(scrollback index)");
+            return;
+        }
+        TrigramIndex::frozen_candidates(
+            (uint8_t const *)mapped,
+            needle,
+            &frozen_blocks);
+        munmap(mapped, part.size);
+        if (!search_blocks(frozen_blocks))
+        {
+            return;
+        }
+    }
+
+    /* lines which were spilled without their index */
+    uint64_t const unindexed = std::max<uint64_t>(
+        frozen.empty()? 0 : frozen.back().end * TrigramIndex::block_lines,
+        dropped);
+    for (uint64_t line = unindexed;
+         line < pruned * TrigramIndex::block_lines;
+         ++line)
+    {
+        if (!search_line(line - dropped))
+        {
+            return;
+        }
+    }
+
+    search_blocks(blocks);
+}
+
+size_t Scrollback::size(void) const
+{
+    return spilled + lines.size();
+}
+
+size_t Scrollback::capacity(void) const
+{
+    return max_lines;
+}
+
+void Scrollback::set_capacity(size_t capacity)
+{
+    if (capacity == 0)
+    {
+        capacity = 1;
+    }
+
+    /* put the ring back in order, oldest first */
+    std::rotate(lines.begin(), lines.begin() + first, lines.end());
+    first = 0;
+
+    /* lines which no longer fit leave the ring */
+    if (lines.size() > capacity)
+    {
+        size_t const excess = lines.size() - capacity;
+        for (size_t i = 0; i < excess; ++i)
+        {
+            bytes -= encoded_size(lines[i].get());
+            evict(std::move(lines[i]));
+        }
+        lines.erase(lines.begin(), lines.begin() + excess);
+    }
+    max_lines = capacity;
+}
+
+bool Scrollback::spill_to(std::string const &path)
+{
+    /* lines spilled somewhere else are forgotten */
+    segment.close();
+    segment.unmap();
+    index.close();
+    index.unmap();
+    spilled = 0;
+    close_frozen();
+
+    frozen_fd = open(
+        (path + ".tri").c_str(),
+        O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0600);
+    if (    frozen_fd == -1
+        ||  !segment.open(path + ".seg", SEGMENT_CHUNK)
+        ||  !index.open(path + ".idx", INDEX_CHUNK))
+    {
+        segment.close();
+        index.close();
+        close_frozen();
+        return false;
+    }
+    return true;
+}
+
+size_t Scrollback::spilled_lines(void) const
+{
+    return spilled;
+}
+
+size_t Scrollback::spilled_bytes(void) const
+{
+    return segment.size + index.size + frozen_size;
+}
+
+size_t Scrollback::memory_usage(void) const
+{
+    /* only the chunk being appended to stays resident */
+    return sizeof(*this) - sizeof(text_index)
+         + text_index.memory_usage()
+         + (frozen.capacity() * sizeof(FrozenPart))
+         + (lines.capacity() * sizeof(Encoded))
+         + bytes
+         + ((segment.chunks.size() != 0)? SEGMENT_CHUNK : 0)
+         + ((index.chunks.size() != 0)? INDEX_CHUNK : 0);
+}
+
+
+bool Scrollback::SpillFile::append(
+    void const *data,
+    size_t n,
+    uint64_t *offset)
+{
+    /* start a new chunk if this won't fit in the current one */
+    size_t const used = size % chunk_size;
+    if (used != 0 && used + n > chunk_size)
+    {
+        size += chunk_size - used;
+    }
+
+    if (size / chunk_size == chunks.size())
+    {
+        size_t const start = chunks.size() * chunk_size;
+        if (ftruncate(fd, start + chunk_size) == -1)
+        {
+            return false;
+        }
+        void *chunk = mmap(
+            nullptr,
+            chunk_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            fd,
+            start);
+        if (chunk == MAP_FAILED)
+        {
+            return false;
+        }
+
+        /* the previous chunk is finished with, let it be written out
+         * and dropped from memory; it's paged back in if it's read */
+        if (chunks.size() != 0)
+        {
+            msync(chunks.back(), chunk_size, MS_ASYNC);
+            madvise(chunks.back(), chunk_size, MADV_DONTNEED);
+        }
+        chunks.push_back((uint8_t *)chunk);
+    }
+
+    memcpy(chunks[size / chunk_size] + (size % chunk_size), data, n);
+    if (offset != nullptr)
+    {
+        *offset = size;
+    }
+    size += n;
+    return true;
+}
+
+uint8_t const *Scrollback::SpillFile::at(uint64_t offset) const
+{
+    return chunks.at(offset / chunk_size) + (offset % chunk_size);
+}
+
+bool Scrollback::SpillFile::open(std::string const &path, size_t chunk)
+{
+    chunk_size = chunk;
+    size = 0;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    return fd != -1;
+}
+
+void Scrollback::SpillFile::close(void)
+{
+    if (fd != -1)
+    {
+        /* drop the unused end of the last chunk */
+        if (ftruncate(fd, size) == -1)
+        {
+            perror("ftruncate(spill)");
+        }
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void Scrollback::SpillFile::unmap(void)
+{
+    for (uint8_t *chunk : chunks)
+    {
+        munmap(chunk, chunk_size);
+    }
+    chunks.clear();
+    size = 0;
+}
+
+
+
+Scrollback::Scrollback(size_t capacity)
+:   lines(),
+    max_lines(capacity == 0? 1 : capacity),
+    first(0),
+    bytes(0),
+    segment{-1, SEGMENT_CHUNK, 0, {}},
+    index{-1, INDEX_CHUNK, 0, {}},
+    spilled(0),
+    pushed(0),
+    pruned(0),
+    text_index(),
+    frozen_fd(-1),
+    frozen_size(0),
+    frozen()
+{
+}
+
+Scrollback::~Scrollback()
+{
+    close_frozen();
+    segment.close();
+    segment.unmap();
+    index.close();
+    index.unmap();
+}
+
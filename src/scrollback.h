@@ -0,0 +1,164 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * scrollback.h
+ *
+ *  Lines which have scrolled off the top of the screen.
+ *  The newest lines are kept in a fixed-size ring, in a compact form:
+ *  trailing blanks are dropped, attributes are run-length encoded, and
+ *  blank lines take no space at all.
+ *  Lines older than the ring can be spilled to an append-only segment
+ *  file with an index of line offsets, both memory-mapped, so the whole
+ *  history is kept without growing the resident size. Their part of
+ *  the trigram index is frozen into a third file, which is only mapped
+ *  while it's searched.
+ *
+ */
+
+#ifndef _SCROLLBACK_H
+#define _SCROLLBACK_H
+
+
+#include "trigramindex.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+struct Line;
+
+
+class Scrollback
+{
+    /* an encoded line, nullptr for a blank line */
+    typedef std::unique_ptr<uint8_t[]> Encoded;
+
+    /* an append-only file, mapped in fixed-size chunks so the
+     * mappings never move */
+    struct SpillFile
+    {
+        int fd;
+        size_t chunk_size,
+               size;        /* bytes used */
+        std::vector<uint8_t *> chunks;
+
+        /* append n bytes (n <= chunk_size), records never straddle a
+         * chunk, returns false on error */
+        bool append(void const *data, size_t n, uint64_t *offset);
+        uint8_t const *at(uint64_t offset) const;
+
+        bool open(std::string const &path, size_t chunk_size);
+        /* stop appending, what's mapped can still be read */
+        void close(void);
+        void unmap(void);
+    };
+
+    std::vector<Encoded> lines;
+    size_t max_lines,
+           first,       /* index of the oldest line, once full */
+           bytes;       /* encoded size of all the lines */
+
+    /* lines older than the ring */
+    SpillFile segment,  /* the encoded lines */
+              index;    /* the offset of each line in segment */
+    size_t spilled;
+
+    /* every line ever pushed, dropped ones included; line numbers in
+     * text_index count from the first of them */
+    uint64_t pushed,
+             pruned;    /* blocks before this were pruned */
+    TrigramIndex text_index;
+
+    /* the index of blocks pruned while spilling, frozen into path.tri
+     * one part at a time; each part is page-aligned, and covers the
+     * blocks from the end of the one before it up to end */
+    struct FrozenPart
+    {
+        uint64_t offset,
+                 size,
+                 end;
+    };
+    int frozen_fd;
+    uint64_t frozen_size;
+    std::vector<FrozenPart> frozen;
+
+    static Encoded encode(Line const &line, size_t *size);
+    static size_t encoded_size(uint8_t const *encoded);
+    static Line decode(uint8_t const *encoded, size_t cols);
+    /* the characters of an encoded line */
+    static size_t text(uint8_t const *encoded, uint8_t const **chars);
+
+    /* the encoded form of line idx, nullptr if it's blank */
+    uint8_t const *at(size_t idx) const;
+
+    /* move the oldest line out of the ring, to disk if spilling */
+    void evict(Encoded encoded);
+    /* append a part of the frozen index covering blocks up to end */
+    void freeze(std::vector<uint8_t> const &part, uint64_t end);
+    void close_frozen(void);
+
+public:
+    static size_t const default_capacity = 100000;
+
+    /* where a search matched: line number as for get(), and column */
+    struct Hit
+    {
+        size_t line,
+               col;
+    };
+
+    /* find where needle occurs in chars, adding line to the hits,
+     * returns false once max_hits is reached */
+    static bool find(
+        uint8_t const *chars,
+        size_t size,
+        std::string const &needle,
+        bool ignore_case,
+        size_t line,
+        size_t max_hits,
+        std::vector<Hit> *hits);
+
+    /* add a line as the newest, the oldest leaves the ring when full */
+    void push(Line const &line);
+
+    /* get line idx (0 is the oldest) padded or cut to cols */
+    Line get(size_t idx, size_t cols) const;
+
+    /* find the first max_hits occurrences of needle, oldest first,
+     * using the trigram index to skip lines which can't match */
+    void search(
+        std::string const &needle,
+        bool ignore_case,
+        size_t max_hits,
+        std::vector<Hit> *hits) const;
+
+    /* number of lines held, including spilled ones */
+    size_t size(void) const;
+    /* number of lines kept in memory */
+    size_t capacity(void) const;
+    /* change the number of lines kept in memory */
+    void set_capacity(size_t capacity);
+
+    /* keep lines leaving the ring in path.seg and path.idx, and their
+     * index in path.tri, rather than dropping them, returns false on
+     * error */
+    bool spill_to(std::string const &path);
+    size_t spilled_lines(void) const;
+    size_t spilled_bytes(void) const;
+
+    /* approximate memory used, in bytes, not counting spilled lines */
+    size_t memory_usage(void) const;
+
+
+    Scrollback(size_t capacity=default_capacity);
+    Scrollback(Scrollback const &other) = delete;
+    Scrollback &operator=(Scrollback const &other) = delete;
+    ~Scrollback();
+};
+
+
+#endif
+
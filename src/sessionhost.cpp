@@ -0,0 +1,544 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * sessionhost.cpp
+ *
+ *  Headless multi-session host
+ *
+ */
+
+#include "sessionhost.h"
+#include "metrics.h"
+#include "pty.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <algorithm>
+#include <string>
+
+
+/* how many reads a session gets per turn before the next session */
+static size_t const READS_PER_TURN = 4;
+/* how much is parsed between checks of the time slice */
+static size_t const PARSE_CHUNK = 4096;
+
+
+
+size_t Session::memory_usage(void) const
+{
+    return sizeof(*this) - sizeof(term) + term.memory_usage();
+}
+
+
+bool SessionHost::spawn(
+    char *const argv[],
+    int cols,
+    int rows,
+    Session::Priority priority)
+{
+    std::unique_ptr<Session> session(new Session{});
+    session->host = this;
+    session->priority = priority;
+    session->term.resize(cols, rows);
+    session->term.scrollback.set_capacity(history.lines);
+    session->memory.store(session->memory_usage());
+
+    std::string slave_name;
+    session->pid = spawn_pty(
+        argv,
+        cols,
+        rows,
+        &session->master,
+        &slave_name);
+    if (session->pid == -1)
+    {
+        return false;
+    }
+
+    /* the session's history is named after its process */
+    if (    !history.spill_dir.empty()
+        &&  !session->term.scrollback.spill_to(
+                history.spill_dir
+                + "/session-" + std::to_string(session->pid)))
+    {
+        perror(("spill to " + history.spill_dir).c_str());
+    }
+
+    struct epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = session.get();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, session->master, &event) == -1)
+    {
+        int errno_backup = errno;
+        kill(session->pid, SIGKILL);
+        close(session->master);
+        errno = errno_backup;
+        return false;
+    }
+
+    sessions.push_back(std::move(session));
+    return true;
+}
+
+void SessionHost::read_input(Session *session)
+{
+    session->ready = false;
+
+    for (size_t i = 0; i < READS_PER_TURN; ++i)
+    {
+        /* read straight into the session's input */
+        struct iovec iov[2];
+        int segments = session->input.reserve(iov);
+        if (segments == 0)
+        {
+            /* backpressure: stop reading until the parser catches up,
+             * so the pty fills up and the child blocks */
+            session->throttled.store(true);
+            break;
+        }
+
+        ssize_t bytesread = readv(session->master, iov, segments);
+        if (bytesread > 0)
+        {
+            session->input.commit(bytesread);
+            session->bytes_in += bytesread;
+            bytes_in += bytesread;
+        }
+        else if (bytesread == -1 && errno == EAGAIN)
+        {
+            break;
+        }
+        else
+        {
+            /* EIO or EOF: the child process quit */
+            epoll_ctl(epfd, EPOLL_CTL_DEL, session->master, nullptr);
+            session->hungup.store(true);
+            break;
+        }
+
+        /* out of reads for this turn, come back to it later */
+        if (i + 1 == READS_PER_TURN)
+        {
+            session->ready = true;
+            ready.push_back(session);
+        }
+    }
+
+    schedule(session);
+}
+
+void SessionHost::schedule(Session *session)
+{
+    /* an interactive session which was idle jumps the queue,
+     * keystrokes shouldn't wait behind someone's build log */
+    if (!session->scheduled.exchange(true))
+    {
+        submit(session, session->priority == Session::INTERACTIVE);
+    }
+}
+
+void SessionHost::submit(Session *session, bool urgent)
+{
+    session->queued_at = std::chrono::steady_clock::now();
+    pool.submit(parse, session, urgent);
+}
+
+void SessionHost::wakeup(Session *session)
+{
+    {
+        std::lock_guard<std::mutex> guard(wakeup_lock);
+        wakeups.push_back(session);
+    }
+    wake_epoll();
+}
+
+void SessionHost::finish(Session *session)
+{
+    {
+        std::lock_guard<std::mutex> guard(wakeup_lock);
+        finished.push_back(session);
+    }
+    wake_epoll();
+}
+
+void SessionHost::wake_epoll(void)
+{
+    uint64_t one = 1;
+    if (write(wakefd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("write(eventfd)");
+    }
+}
+
+void SessionHost::parse(void *arg)
+{
+    Session *session = (Session *)arg;
+    SessionHost *host = session->host;
+    SessionHost::Budget const &budget = host->budget;
+    VT102 &term = session->term;
+
+    auto const start = std::chrono::steady_clock::now();
+    unsigned long long const waited =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            start - session->queued_at).count();
+    Session::Latency &latency = session->latency;
+    latency.turns.fetch_add(1, std::memory_order_relaxed);
+    latency.total_ns.fetch_add(waited, std::memory_order_relaxed);
+    if (waited > latency.max_ns.load(std::memory_order_relaxed))
+    {
+        latency.max_ns.store(waited, std::memory_order_relaxed);
+    }
+
+    /* parse straight out of the ring, up to this turn's share; the
+     * rest stays in the ring, and once that fills, in the pty */
+    unsigned const weight = budget.weight[session->priority];
+    auto const timeslice = budget.timeslice * weight;
+    session->deficit += budget.quantum * weight;
+    for (;;)
+    {
+        struct iovec iov[2];
+        if (session->deficit == 0 || session->input.peek(iov) == 0)
+        {
+            break;
+        }
+
+        size_t const n = std::min(
+            {iov[0].iov_len, session->deficit, PARSE_CHUNK});
+        term.interpret_bytes((uint8_t *)iov[0].iov_base, n);
+        session->input.consume(n);
+        session->deficit -= n;
+
+        if (std::chrono::steady_clock::now() - start >= timeslice)
+        {
+            break;
+        }
+    }
+    /* an idle session doesn't get to save up its share, and one which
+     * ran out of time doesn't get more than a turn's worth next time */
+    session->deficit = session->input.empty()
+        ? 0
+        : std::min(session->deficit, budget.quantum * weight);
+
+    /* write replies (DA, DSR, etc.) and echoed keyboard input */
+    if (term.outbuffer.size() != 0)
+    {
+        size_t queued = session->outqueue.enqueue(
+            term.outbuffer.data(),
+            term.outbuffer.size());
+        term.outbuffer.erase(0, queued);
+    }
+    if (    session->outqueue.flush(session->master) == -1
+        &&  !session->hungup.load())
+    {
+        perror("writev(master)");
+    }
+
+    session->memory.store(
+        session->memory_usage(),
+        std::memory_order_relaxed);
+
+    /* there's room again, let the epoll thread read some more, unless
+     * there's nothing left to read */
+    if (session->throttled.exchange(false) && !session->hungup.load())
+    {
+        host->wakeup(session);
+    }
+
+    /* done with the session for good: it stays scheduled, so no more
+     * tasks are made for it, and once it's handed over the epoll
+     * thread frees it */
+    if (session->hungup.load() && session->input.empty())
+    {
+        host->finish(session);
+        return;
+    }
+
+    session->scheduled.store(false);
+
+    /* go to the back of the queue with whatever's left, or catch
+     * anything which came in while we were running */
+    if (    (   !session->input.empty()
+             || session->hungup.load()
+             || session->throttled.load())
+        &&  !session->scheduled.exchange(true))
+    {
+        host->submit(session, false);
+    }
+}
+
+void SessionHost::close_session(Session *session)
+{
+    /* closing the fd removes it from the epoll set */
+    close(session->master);
+    session->master = -1;
+    kill(session->pid, SIGHUP);
+}
+
+void SessionHost::run(std::chrono::seconds report_interval)
+{
+    /* children are reaped automatically */
+    signal(SIGCHLD, SIG_IGN);
+
+    auto cpu_time = []()
+    {
+        struct rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+             + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    };
+
+    auto last_report = std::chrono::steady_clock::now();
+    double last_cpu = cpu_time();
+    unsigned long long last_bytes = bytes_in;
+
+    struct epoll_event events[256];
+    while (sessions.size() != 0)
+    {
+        /* don't sleep while some sessions still have input */
+        int nfds = epoll_wait(
+            epfd,
+            events,
+            sizeof(events) / sizeof(*events),
+            ready.empty()? 1000 : 0);
+        if (nfds == -1 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+
+        bool woken = false;
+        for (int i = 0; i < nfds; ++i)
+        {
+            Session *session = (Session *)events[i].data.ptr;
+            if (session == nullptr)
+            {
+                woken = true;
+            }
+            else if (session->hungup.load())
+            {
+                /* already being wound down */
+            }
+            else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+            {
+                if (!session->ready)
+                {
+                    read_input(session);
+                }
+            }
+            /* the pty can take more of the session's output */
+            else if (events[i].events & EPOLLOUT)
+            {
+                schedule(session);
+            }
+        }
+
+        /* give the sessions which used up their turn another go */
+        std::vector<Session *> again;
+        again.swap(ready);
+        for (Session *session : again)
+        {
+            if (session->ready && !session->hungup.load())
+            {
+                read_input(session);
+            }
+        }
+
+        /* sessions handed back by the parsers */
+        if (woken)
+        {
+            uint64_t count = 0;
+            if (read(wakefd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            {
+                perror("read(eventfd)");
+            }
+
+            /* both lists are taken at once, so a session's wakeups are
+             * always seen before (or with) its handover, never after
+             * it has been freed */
+            std::vector<Session *> woken_sessions,
+                                   finished_sessions;
+            {
+                std::lock_guard<std::mutex> guard(wakeup_lock);
+                woken_sessions.swap(wakeups);
+                finished_sessions.swap(finished);
+            }
+            for (Session *session : woken_sessions)
+            {
+                /* no longer throttled; one which has hung up is left
+                 * for its parse task to finish */
+                if (!session->hungup.load())
+                {
+                    read_input(session);
+                }
+            }
+            for (Session *session : finished_sessions)
+            {
+                close_session(session);
+            }
+        }
+
+        /* forget the sessions which have exited */
+        ready.erase(
+            std::remove_if(
+                ready.begin(),
+                ready.end(),
+                [](Session *session){ return session->master == -1; }),
+            ready.end());
+        sessions.erase(
+            std::remove_if(
+                sessions.begin(),
+                sessions.end(),
+                [](std::unique_ptr<Session> const &session)
+                {
+                    return session->master == -1;
+                }),
+            sessions.end());
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= report_interval)
+        {
+            double cpu = cpu_time();
+            report(
+                stdout,
+                bytes_in - last_bytes,
+                cpu - last_cpu,
+                std::chrono::duration<double>(now - last_report).count());
+            last_report = now;
+            last_cpu = cpu;
+            last_bytes = bytes_in;
+        }
+    }
+}
+
+void SessionHost::report(
+    FILE *out,
+    unsigned long long bytes,
+    double cpu,
+    double wall)
+{
+    size_t memory = 0;
+    /* per Session::Priority */
+    size_t count[2] = {0, 0};
+    unsigned long long turns[2] = {0, 0},
+                       total_ns[2] = {0, 0},
+                       max_ns[2] = {0, 0};
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        Session *session = sessions[i].get();
+        size_t const session_memory =\
+            session->memory.load(std::memory_order_relaxed);
+        memory += session_memory;
+        if (i < METRICS_MAX_SESSIONS)
+        {
+            metrics.session_memory[i].store(
+                session_memory,
+                std::memory_order_relaxed);
+        }
+
+        /* start afresh for the next report */
+        Session::Latency &latency = session->latency;
+        Session::Priority const priority = session->priority;
+        count[priority] += 1;
+        turns[priority] += latency.turns.exchange(0);
+        total_ns[priority] += latency.total_ns.exchange(0);
+        max_ns[priority] = std::max(
+            max_ns[priority],
+            latency.max_ns.exchange(0));
+    }
+    metrics.sessions.store(sessions.size(), std::memory_order_relaxed);
+
+    double const cores_busy = cpu / wall;
+    long const cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    fprintf(
+        out,
+        "host: %zu sessions, %.2f MiB/s read, %.3f of %ld cores busy, ",
+        sessions.size(),
+        bytes / wall / (1024 * 1024),
+        cores_busy,
+        cores);
+    if (cores_busy > 0)
+    {
+        fprintf(out, "%.0f sessions/core, ", sessions.size() / cores_busy);
+    }
+    fprintf(
+        out,
+        "%zu bytes/session, %zu parsers, %llu tasks (%llu stolen)\n",
+        sessions.size() == 0? 0 : memory / sessions.size(),
+        pool.size(),
+        pool.tasks_run(),
+        pool.tasks_stolen());
+
+    char const *const names[2] = {"interactive", "batch"};
+    for (int i = 0; i < 2; ++i)
+    {
+        if (count[i] == 0)
+        {
+            continue;
+        }
+        fprintf(
+            out,
+            "host: %zu %s, %llu turns, "
+            "queue latency %.1f us mean, %.1f us max\n",
+            count[i],
+            names[i],
+            turns[i],
+            turns[i] == 0? 0.0 : total_ns[i] / 1e3 / turns[i],
+            max_ns[i] / 1e3);
+    }
+    fflush(out);
+}
+
+
+
+SessionHost::SessionHost(size_t parsers)
+:   epfd(epoll_create1(EPOLL_CLOEXEC)),
+    wakefd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    sessions(),
+    ready(),
+    wakeup_lock(),
+    wakeups(),
+    finished(),
+    bytes_in(0),
+    pool(parsers),
+    budget{4096, std::chrono::milliseconds(1), {4, 1}},
+    history{Scrollback::default_capacity, ""}
+{
+    if (epfd == -1 || wakefd == -1)
+    {
+        perror("SessionHost");
+        exit(EXIT_FAILURE);
+    }
+
+    /* parsers wake the epoll thread through wakefd */
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &event) == -1)
+    {
+        perror("epoll_ctl(wakefd)");
+        exit(EXIT_FAILURE);
+    }
+}
+
+SessionHost::~SessionHost()
+{
+    pool.stop();
+    for (std::unique_ptr<Session> const &session : sessions)
+    {
+        if (session->master != -1)
+        {
+            close_session(session.get());
+        }
+    }
+    close(wakefd);
+    close(epfd);
+}
+
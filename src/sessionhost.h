@@ -0,0 +1,178 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * sessionhost.h
+ *
+ *  Headless host for many terminal sessions.
+ *  Every session's pty is read from a single epoll loop, and the
+ *  input is parsed on a work-stealing pool of parser threads,
+ *  with no thread per session.
+ *
+ */
+
+#ifndef _SESSIONHOST_H
+#define _SESSIONHOST_H
+
+
+#include "vt102.h"
+#include "outqueue.h"
+#include "ringbuffer.h"
+#include "workpool.h"
+
+#include <sys/types.h>
+
+#include <cstdio>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+class SessionHost;
+
+struct Session
+{
+    SessionHost *host;
+
+    /* interactive sessions get a bigger share of the parsers, and
+     * are parsed ahead of the queue when they've been idle */
+    enum Priority {INTERACTIVE, BATCH} priority;
+
+    /* only touched by the session's parse task */
+    VT102 term;
+    OutQueue outqueue;
+
+    /* written by the epoll thread, read by the parse task */
+    RingBuffer<16384> input;
+
+    int master;
+    pid_t pid;
+
+    /* epoll thread only */
+    unsigned long long bytes_in;
+    bool ready;
+
+    /* set while a parse task for the session is queued or running,
+     * so no two workers ever touch the same session */
+    std::atomic<bool> scheduled;
+    /* when the current task was queued, written by whoever set
+     * scheduled */
+    std::chrono::steady_clock::time_point queued_at;
+    /* bytes the session may still parse this round (deficit
+     * round-robin), only touched by the parse task */
+    size_t deficit;
+    /* input was full, so the epoll thread stopped reading */
+    std::atomic<bool> throttled;
+    /* the pty has hung up */
+    std::atomic<bool> hungup;
+    /* the terminal's approximate memory usage, stored by the parse
+     * task so nothing else has to look at the terminal */
+    std::atomic<size_t> memory;
+
+    /* time the session's tasks spent queued before running,
+     * since the last report */
+    struct Latency
+    {
+        std::atomic<unsigned long long> turns,
+                                        total_ns,
+                                        max_ns;
+    } latency;
+
+    /* approximate memory used by the session, in bytes; only the
+     * parse task may call this, anyone can read `memory` */
+    size_t memory_usage(void) const;
+};
+
+
+class SessionHost
+{
+    int epfd,
+        wakefd;
+    std::vector<std::unique_ptr<Session>> sessions;
+
+    /* sessions which still had input left after their turn; the epoll
+     * fds are edge-triggered, so these won't be reported again */
+    std::vector<Session *> ready;
+
+    /* sessions handed back to the epoll thread by the parsers: ones
+     * which can be read from again, and ones which have hung up and
+     * which no parse task will touch again, to be closed and freed */
+    std::mutex wakeup_lock;
+    std::vector<Session *> wakeups,
+                           finished;
+
+    char buf[65536];
+
+    unsigned long long bytes_in;
+
+    /* stopped first thing in ~SessionHost(), the workers use the
+     * sessions, wakefd, budget and the rest */
+    WorkPool pool;
+
+    /* epoll thread: read from a session's pty into its input */
+    void read_input(Session *session);
+    /* make sure a parse task is queued for the session */
+    void schedule(Session *session);
+    /* queue a parse task, the caller must have set scheduled */
+    void submit(Session *session, bool urgent);
+    /* parser: hand a session back to the epoll thread */
+    void wakeup(Session *session);
+    /* parser: hand a hung up session over to be freed, the caller
+     * mustn't touch it after this */
+    void finish(Session *session);
+    /* parser: wake the epoll thread up */
+    void wake_epoll(void);
+    /* parse task: parse the session's input and write its replies */
+    static void parse(void *session);
+
+    void close_session(Session *session);
+
+public:
+    /* how much parsing a session gets per turn; a session with input
+     * left over goes to the back of the queue, and the rest waits in
+     * its pty */
+    struct Budget
+    {
+        size_t quantum;                     /* bytes per turn */
+        std::chrono::nanoseconds timeslice; /* time per turn */
+        unsigned weight[2];                 /* per Session::Priority */
+    } budget;
+
+    /* scrollback lines kept in memory per session, and where older
+     * ones are spilled to (empty to drop them) */
+    struct History
+    {
+        size_t lines;
+        std::string spill_dir;
+    } history;
+
+    /* start argv in a new session, returns false on error */
+    bool spawn(
+        char *const argv[],
+        int cols,
+        int rows,
+        Session::Priority priority=Session::INTERACTIVE);
+
+    /* service all the sessions until every one has exited,
+     * printing a report every report_interval */
+    void run(std::chrono::seconds report_interval);
+
+    /* print sessions per core, per-session memory and queue latency,
+     * given the bytes read and cpu time used over the last wall
+     * seconds */
+    void report(
+        FILE *out,
+        unsigned long long bytes,
+        double cpu,
+        double wall);
+
+
+    SessionHost(size_t parsers);
+    ~SessionHost();
+};
+
+
+#endif
+
@@ -0,0 +1,34 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * signalsafe.cpp
+ *
+ *  Building blocks for dumps made by signal handlers
+ *
+ */
+
+#include "signalsafe.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+
+
+bool write_all(int fd, void const *data, size_t size)
+{
+    char const *bytes = (char const *)data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * signalsafe.h
+ *
+ *  What the dumps a signal handler can ask for (parse statistics, the
+ *  parser trace) are built on: per-thread blocks which any thread can
+ *  walk, and writing them out.
+ *  Walking the blocks and writing only make async-signal-safe calls,
+ *  so a dump which does nothing else can be made by a signal handler.
+ *
+ */
+
+#ifndef _SIGNALSAFE_H
+#define _SIGNALSAFE_H
+
+
+#include <cstddef>
+
+#include <atomic>
+
+
+/* a block of type T for each of up to N threads, made when the thread
+ * asks for it; blocks are never freed, so a thread's block outlives it
+ * and can be read by any thread at any time */
+template<typename T, size_t N>
+class ThreadBlocks
+{
+    std::atomic<T *> blocks[N];
+    std::atomic<size_t> count;
+
+public:
+    static constexpr size_t capacity = N;
+
+    /* make the calling thread's block, nullptr if there are already
+     * N; it's the caller's to remember */
+    T *add(void)
+    {
+        size_t const idx = count.fetch_add(1);
+        if (idx >= N)
+        {
+            return nullptr;
+        }
+        T *block = new T();
+        blocks[idx].store(block, std::memory_order_release);
+        return block;
+    }
+
+    /* call f with every block, oldest first; blocks which are being
+     * made are skipped */
+    template<typename F>
+    void for_each(F f) const
+    {
+        size_t const n = count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n && i < N; ++i)
+        {
+            T *block = blocks[i].load(std::memory_order_acquire);
+            if (block != nullptr)
+            {
+                f(block);
+            }
+        }
+    }
+
+
+    constexpr ThreadBlocks()
+    :   blocks(),
+        count(0)
+    {
+    }
+    ThreadBlocks(ThreadBlocks const &other) = delete;
+    ThreadBlocks &operator=(ThreadBlocks const &other) = delete;
+};
+
+
+/* write all of data to fd, retrying when interrupted, returns false on
+ * error */
+bool write_all(int fd, void const *data, size_t size);
+
+
+#endif
@@ -0,0 +1,288 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * trace.cpp
+ *
+ *  Binary trace of what the parser does
+ *
+ */
+
+#include "trace.h"
+#include "signalsafe.h"
+
+#include <cinttypes>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+
+static char const trace_magic[8] = { 'V','T','1','0','2','T','R','C' };
+static uint32_t const trace_version = 1;
+
+/* a dump is this header, then for each ring a RingHeader, its records
+ * (oldest first) and a RingTrailer, all in host byte order */
+struct DumpHeader
+{
+    char magic[8];
+    uint32_t version,
+             record_size,
+             rings,
+             padding;
+};
+
+struct RingHeader
+{
+    uint32_t thread,
+             records;
+};
+
+struct RingTrailer
+{
+    /* how many of the oldest records were overwritten while they were
+     * being written out, and can't be trusted */
+    uint32_t overwritten,
+             padding;
+};
+
+
+struct TraceRing
+{
+    /* records ever added; the next one goes in records[head % size] */
+    std::atomic<uint64_t> head;
+    /* records ever started, one ahead of head while one is written */
+    std::atomic<uint64_t> claimed;
+    TraceRecord records[TRACE_RING_RECORDS];
+};
+
+/* threads after the first 64 aren't traced */
+static ThreadBlocks<TraceRing, 64> rings;
+
+static thread_local struct
+{
+    TraceRing *ring;
+    bool untraced;
+    uint8_t byte,
+            state;
+} context;
+
+
+static TraceRing *get_ring(void)
+{
+    if (context.ring == nullptr && !context.untraced)
+    {
+        context.ring = rings.add();
+        context.untraced = (context.ring == nullptr);
+    }
+    return context.ring;
+}
+
+void trace_byte(uint8_t byte, uint8_t state)
+{
+    context.byte = byte;
+    context.state = state;
+}
+
+void trace(TraceOp op, int32_t arg0, int32_t arg1)
+{
+    TraceRing *ring = get_ring();
+    if (ring == nullptr)
+    {
+        return;
+    }
+
+    /* only this thread writes to its ring, so the head needn't be
+     * read atomically with anything */
+    uint64_t const head = ring->head.load(std::memory_order_relaxed);
+    TraceRecord &record = ring->records[head % TRACE_RING_RECORDS];
+    /* a dump which reads the slot while it's written sees the claim */
+    ring->claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.op = op;
+    record.state = context.state;
+    record.byte = context.byte;
+    /* readers which see the new head see the record */
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+
+bool trace_dump(int fd)
+{
+    /* the rings are counted before any are written out */
+    TraceRing const *dumped[decltype(rings)::capacity];
+    size_t n = 0;
+    rings.for_each([&](TraceRing const *ring) { dumped[n++] = ring; });
+
+    DumpHeader header;
+    memcpy(header.magic, trace_magic, sizeof(trace_magic));
+    header.version = trace_version;
+    header.record_size = sizeof(TraceRecord);
+    header.rings = n;
+    header.padding = 0;
+    if (!write_all(fd, &header, sizeof(header)))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        TraceRing const *ring = dumped[i];
+        uint64_t const head = ring->head.load(std::memory_order_acquire),
+                       first = (head > TRACE_RING_RECORDS)
+                           ? head - TRACE_RING_RECORDS
+                           : 0;
+
+        RingHeader ring_header{ (uint32_t)i, (uint32_t)(head - first) };
+        if (!write_all(fd, &ring_header, sizeof(ring_header)))
+        {
+            return false;
+        }
+
+        /* straight out of the ring, in (up to) two pieces */
+        size_t const start = first % TRACE_RING_RECORDS,
+                     size = head - first,
+                     tail = std::min(size, TRACE_RING_RECORDS - start);
+        if (    !write_all(
+                    fd,
+                    ring->records + start,
+                    tail * sizeof(TraceRecord))
+            ||  !write_all(
+                    fd,
+                    ring->records,
+                    (size - tail) * sizeof(TraceRecord)))
+        {
+            return false;
+        }
+
+        /* the thread may have carried on, writing over the oldest */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t const now = ring->claimed.load(std::memory_order_relaxed);
+        uint64_t const lost = (now > first + TRACE_RING_RECORDS)
+            ? now - (first + TRACE_RING_RECORDS)
+            : 0;
+        RingTrailer trailer{ (uint32_t)std::min<uint64_t>(lost, size), 0 };
+        if (!write_all(fd, &trailer, sizeof(trailer)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+char const *trace_op_name(TraceOp op)
+{
+    switch (op)
+    {
+#define X(name, args)       \
+    case TraceOp::name:     \
+        return #name;
+    TRACE_OPS(X)
+#undef X
+    }
+    return "?";
+}
+
+static int trace_op_args(TraceOp op)
+{
+    switch (op)
+    {
+#define X(name, args)       \
+    case TraceOp::name:     \
+        return args;
+    TRACE_OPS(X)
+#undef X
+    }
+    return 2;
+}
+
+bool trace_decode(FILE *in, FILE *out)
+{
+    DumpHeader header;
+    if (    fread(&header, sizeof(header), 1, in) != 1
+        ||  memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0
+        ||  header.version != trace_version
+        ||  header.record_size != sizeof(TraceRecord))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.rings; ++i)
+    {
+        RingHeader ring_header;
+        if (fread(&ring_header, sizeof(ring_header), 1, in) != 1)
+        {
+            return false;
+        }
+
+        /* records are checked against the trailer before printing */
+        long const records = ftell(in);
+        if (    fseek(
+                    in,
+                    (long)ring_header.records * sizeof(TraceRecord),
+                    SEEK_CUR) != 0)
+        {
+            return false;
+        }
+        RingTrailer trailer;
+        if (    fread(&trailer, sizeof(trailer), 1, in) != 1
+            ||  fseek(in, records, SEEK_SET) != 0)
+        {
+            return false;
+        }
+
+        fprintf(
+            out,
+            "thread %" PRIu32 ": %" PRIu32 " records",
+            ring_header.thread,
+            ring_header.records - trailer.overwritten);
+        if (trailer.overwritten != 0)
+        {
+            fprintf(
+                out,
+                " (%" PRIu32 " overwritten while dumping)",
+                trailer.overwritten);
+        }
+        fprintf(out, "\n");
+
+        for (uint32_t r = 0; r < ring_header.records; ++r)
+        {
+            TraceRecord record;
+            if (fread(&record, sizeof(record), 1, in) != 1)
+            {
+                return false;
+            }
+            if (r < trailer.overwritten)
+            {
+                continue;
+            }
+
+            fprintf(
+                out,
+                "%" PRIu64 ".%09" PRIu64 " state %u byte 0x%02x  %s",
+                record.time / 1000000000,
+                record.time % 1000000000,
+                record.state,
+                record.byte,
+                trace_op_name(record.op));
+            for (int arg = 0; arg < trace_op_args(record.op); ++arg)
+            {
+                fprintf(out, " %" PRId32, record.args[arg]);
+            }
+            fprintf(out, "\n");
+        }
+
+        if (fseek(in, sizeof(trailer), SEEK_CUR) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
@@ -0,0 +1,89 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * trace.h
+ *
+ *  Binary trace of what the parser does.
+ *  Only built in with VT102_TRACE defined (make TRACE=1); each thread
+ *  writes records into a ring of its own, which is dumped on demand
+ *  or on a crash and decoded later.
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+
+#include <cstdint>
+#include <cstdio>
+
+
+#ifdef VT102_TRACE
+static bool const trace_enabled = true;
+#else
+static bool const trace_enabled = false;
+#endif
+
+
+/* every kind of record, and how many of its args mean anything */
+#define TRACE_OPS(X)                                                    \
+    /* flow control, with the amount of unparsed input */               \
+    X(XOFF, 1) X(XON, 1)                                                \
+    /* control characters */                                            \
+    X(NUL, 0) X(ETX, 0) X(EOT, 0) X(ENQ, 0) X(BEL, 0) X(BS, 0)          \
+    X(HT, 0) X(LF, 0) X(VT, 0) X(FF, 0) X(CR, 0) X(SO, 0) X(SI, 0)      \
+    X(DC1, 0) X(DC3, 0) X(CAN, 0) X(SUB, 0) X(ESC, 0) X(DEL, 0)         \
+    X(CHAR, 1)                                                          \
+    /* escape sequences */                                              \
+    X(RIS, 0) X(IND, 0) X(NEL, 0) X(HTS, 0) X(RI, 0) X(SS2, 0)          \
+    X(SS3, 0) X(DECID, 0) X(DECSC, 0) X(DECRC, 0) X(CSI, 0)             \
+    X(SCS_G0, 1) X(SCS_G1, 1) X(DECDHL_TOP, 0) X(DECDHL_BOTTOM, 0)      \
+    X(DECSWL, 0) X(DECDWL, 0) X(DECALN, 0)                              \
+    /* control sequences, with their (parsed) parameters */             \
+    X(CUU, 1) X(CUD, 1) X(CUF, 1) X(CUB, 1) X(CUP, 2) X(HVP, 2)         \
+    X(ED, 1) X(EL, 1) X(IL, 1) X(DL, 1) X(DCH, 1) X(DA, 0) X(TBC, 1)    \
+    X(SM, 1) X(RM, 1) X(DECSM, 1) X(DECRM, 1) X(MC, 0) X(SGR, 1)        \
+    X(DSR, 1) X(DECLL, 1) X(DECSTBM, 2) X(DECTST, 0)
+
+enum class TraceOp : uint8_t
+{
+#define X(op, args) op,
+    TRACE_OPS(X)
+#undef X
+};
+
+
+/* one thing the parser did, with up to two numbers to go with it */
+struct TraceRecord
+{
+    /* nanoseconds, steady clock */
+    uint64_t time;
+    int32_t args[2];
+    TraceOp op;
+    /* the parser state and byte it was interpreting at the time */
+    uint8_t state,
+            byte;
+    uint8_t padding[5];
+};
+
+/* records each thread keeps, older ones are overwritten */
+static size_t const TRACE_RING_RECORDS = 16384;
+
+
+/* note the byte the calling thread is about to interpret */
+void trace_byte(uint8_t byte, uint8_t state);
+
+/* add a record to the calling thread's ring */
+void trace(TraceOp op, int32_t arg0=0, int32_t arg1=0);
+
+/* write every thread's ring to fd, oldest records first; it can be
+ * used by a signal handler (see signalsafe.h) */
+bool trace_dump(int fd);
+
+/* print a dump made by trace_dump in readable form */
+bool trace_decode(FILE *in, FILE *out);
+
+char const *trace_op_name(TraceOp op);
+
+
+#endif
+
@@ -0,0 +1,291 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * trigramindex.cpp
+ *
+ *  Block-level trigram index
+ *
+ */
+
+#include "trigramindex.h"
+
+#include <cctype>
+#include <cstring>
+
+#include <algorithm>
+
+
+static uint32_t trigram(uint8_t a, uint8_t b, uint8_t c)
+{
+    return (tolower(a) << 16) | (tolower(b) << 8) | tolower(c);
+}
+
+static void put_varint(std::vector<uint8_t> *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out->push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out->push_back(value);
+}
+
+
+
+std::vector<uint64_t> TrigramIndex::blocks(List const &list)
+{
+    std::vector<uint64_t> out{list.first};
+    uint64_t block = list.first,
+             delta = 0;
+    int shift = 0;
+    for (size_t i = 0; i < list.size; ++i)
+    {
+        uint8_t const byte = list.deltas[i];
+        delta |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80))
+        {
+            block += delta;
+            out.push_back(block);
+            delta = 0;
+            shift = 0;
+        }
+    }
+    return out;
+}
+
+bool TrigramIndex::trigrams(
+    std::string const &needle,
+    std::vector<uint32_t> *out)
+{
+    out->clear();
+    for (size_t i = 0; i + 2 < needle.size(); ++i)
+    {
+        uint8_t const *n = (uint8_t const *)needle.data() + i;
+        if (n[0] == ' ' && n[1] == ' ' && n[2] == ' ')
+        {
+            continue;
+        }
+        out->push_back(trigram(n[0], n[1], n[2]));
+    }
+    return !out->empty();
+}
+
+void TrigramIndex::intersect(
+    std::vector<List> lists,
+    std::vector<uint64_t> *out)
+{
+    /* rarest first */
+    std::sort(
+        lists.begin(),
+        lists.end(),
+        [](List const &a, List const &b)
+        {
+            return a.size < b.size;
+        });
+
+    *out = blocks(lists[0]);
+    for (size_t i = 1; i < lists.size() && !out->empty(); ++i)
+    {
+        std::vector<uint64_t> const other = blocks(lists[i]);
+        std::vector<uint64_t> both;
+        std::set_intersection(
+            out->begin(), out->end(),
+            other.begin(), other.end(),
+            std::back_inserter(both));
+        out->swap(both);
+    }
+}
+
+void TrigramIndex::add(uint64_t line, uint8_t const *text, size_t size)
+{
+    uint64_t const block = line / block_lines;
+    for (size_t i = 0; i + 2 < size; ++i)
+    {
+        /* runs of spaces are everywhere and find nothing */
+        if (text[i] == ' ' && text[i + 1] == ' ' && text[i + 2] == ' ')
+        {
+            continue;
+        }
+
+        uint32_t const key = trigram(text[i], text[i + 1], text[i + 2]);
+        auto it = postings.find(key);
+        if (it == postings.end())
+        {
+            postings.emplace(key, Posting{{}, block, block});
+            bytes += sizeof(Posting) + sizeof(key);
+        }
+        else if (it->second.last != block)
+        {
+            Posting &posting = it->second;
+            size_t const before = posting.deltas.capacity();
+            put_varint(&posting.deltas, block - posting.last);
+            posting.last = block;
+            bytes += posting.deltas.capacity() - before;
+        }
+    }
+}
+
+bool TrigramIndex::candidates(
+    std::string const &needle,
+    std::vector<uint64_t> *out) const
+{
+    out->clear();
+    std::vector<uint32_t> keys;
+    if (!trigrams(needle, &keys))
+    {
+        return false;
+    }
+
+    std::vector<List> lists;
+    for (uint32_t key : keys)
+    {
+        auto it = postings.find(key);
+        if (it == postings.end())
+        {
+            /* it's nowhere */
+            return true;
+        }
+        Posting const &posting = it->second;
+        lists.push_back(
+            List{posting.first, posting.deltas.data(), posting.deltas.size()});
+    }
+    intersect(lists, out);
+    return true;
+}
+
+bool TrigramIndex::frozen_candidates(
+    uint8_t const *frozen,
+    std::string const &needle,
+    std::vector<uint64_t> *out)
+{
+    out->clear();
+    std::vector<uint32_t> keys;
+    if (!trigrams(needle, &keys))
+    {
+        return false;
+    }
+
+    uint64_t count;
+    memcpy(&count, frozen, sizeof(count));
+    FrozenKey const *const begin = (FrozenKey const *)(frozen + 8),
+                    *const end = begin + count;
+
+    std::vector<List> lists;
+    for (uint32_t key : keys)
+    {
+        FrozenKey const *found = std::lower_bound(
+            begin,
+            end,
+            key,
+            [](FrozenKey const &a, uint32_t b)
+            {
+                return a.trigram < b;
+            });
+        if (found == end || found->trigram != key)
+        {
+            return true;
+        }
+        lists.push_back(
+            List{found->first, frozen + found->offset, found->size});
+    }
+    intersect(lists, out);
+    return true;
+}
+
+void TrigramIndex::prune(uint64_t block, std::vector<uint8_t> *frozen)
+{
+    std::vector<FrozenKey> frozen_keys;
+    std::vector<uint8_t> frozen_deltas;
+
+    for (auto it = postings.begin(); it != postings.end();)
+    {
+        Posting &posting = it->second;
+        if (posting.first >= block)
+        {
+            ++it;
+            continue;
+        }
+
+        std::vector<uint64_t> const old = blocks(
+            List{posting.first, posting.deltas.data(), posting.deltas.size()});
+        auto keep = std::lower_bound(old.begin(), old.end(), block);
+
+        if (frozen != nullptr)
+        {
+            size_t const offset = frozen_deltas.size();
+            for (auto b = old.begin() + 1; b != keep; ++b)
+            {
+                put_varint(&frozen_deltas, *b - *(b - 1));
+            }
+            frozen_keys.push_back(
+                FrozenKey{
+                    it->first,
+                    (uint32_t)(frozen_deltas.size() - offset),
+                    posting.first,
+                    offset});
+        }
+
+        if (keep == old.end())
+        {
+            bytes -= sizeof(Posting) + sizeof(it->first)
+                   + posting.deltas.capacity();
+            it = postings.erase(it);
+            continue;
+        }
+
+        bytes -= posting.deltas.capacity();
+        posting.deltas.clear();
+        posting.first = *keep;
+        for (auto b = keep + 1; b != old.end(); ++b)
+        {
+            put_varint(&posting.deltas, *b - *(b - 1));
+        }
+        posting.deltas.shrink_to_fit();
+        bytes += posting.deltas.capacity();
+        ++it;
+    }
+
+    if (frozen == nullptr)
+    {
+        return;
+    }
+    std::sort(
+        frozen_keys.begin(),
+        frozen_keys.end(),
+        [](FrozenKey const &a, FrozenKey const &b)
+        {
+            return a.trigram < b.trigram;
+        });
+    uint64_t const count = frozen_keys.size();
+    size_t const deltas_at = 8 + (count * sizeof(FrozenKey));
+    for (FrozenKey &key : frozen_keys)
+    {
+        key.offset += deltas_at;
+    }
+    frozen->resize(deltas_at);
+    memcpy(frozen->data(), &count, sizeof(count));
+    if (count != 0)
+    {
+        memcpy(
+            frozen->data() + 8,
+            frozen_keys.data(),
+            count * sizeof(FrozenKey));
+    }
+    frozen->insert(frozen->end(), frozen_deltas.begin(), frozen_deltas.end());
+}
+
+size_t TrigramIndex::memory_usage(void) const
+{
+    return sizeof(*this)
+         + (postings.bucket_count() * sizeof(void *))
+         + bytes;
+}
+
+
+
+TrigramIndex::TrigramIndex()
+:   postings(),
+    bytes(0)
+{
+}
+
@@ -0,0 +1,104 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * trigramindex.h
+ *
+ *  Trigram index over lines of text.
+ *  Lines are grouped into blocks, and each trigram maps to the blocks
+ *  it appears in, stored as delta-encoded varints. A search only
+ *  needs to check the blocks which have every trigram of the query.
+ *  Trigrams are case-folded, so the index serves both case-sensitive
+ *  and case-insensitive searches.
+ *  Old blocks can be frozen: written out in a flat, sorted form which
+ *  is searched where it lies, without loading it.
+ *
+ */
+
+#ifndef _TRIGRAMINDEX_H
+#define _TRIGRAMINDEX_H
+
+
+#include <cstddef>
+#include <cstdint>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+class TrigramIndex
+{
+    struct Posting
+    {
+        std::vector<uint8_t> deltas;
+        uint64_t first,     /* first block in the list */
+                 last;      /* last block in the list */
+    };
+
+    /* a posting list to search, in memory or frozen */
+    struct List
+    {
+        uint64_t first;
+        uint8_t const *deltas;
+        size_t size;
+    };
+
+    /* a frozen index is laid out as
+     *  count           8 bytes
+     *  key[count]      FrozenKey each, sorted by trigram
+     *  deltas          the posting lists' deltas
+     * in the host's byte order */
+    struct FrozenKey
+    {
+        uint32_t trigram,
+                 size;      /* bytes of deltas */
+        uint64_t first,
+                 offset;    /* of the deltas, from the start */
+    };
+
+    std::unordered_map<uint32_t, Posting> postings;
+    size_t bytes;
+
+    /* decode the blocks of a posting list */
+    static std::vector<uint64_t> blocks(List const &list);
+    /* the trigrams of needle worth looking up, false if there are
+     * none */
+    static bool trigrams(
+        std::string const &needle,
+        std::vector<uint32_t> *out);
+    /* the blocks in every one of lists */
+    static void intersect(
+        std::vector<List> lists,
+        std::vector<uint64_t> *out);
+
+public:
+    /* lines per block */
+    static size_t const block_lines = 64;
+
+    /* index line number line, lines must be added in order */
+    void add(uint64_t line, uint8_t const *text, size_t size);
+
+    /* the blocks which may contain needle, in order, or all of them
+     * if needle is too short to look up (returns false) */
+    bool candidates(std::string const &needle, std::vector<uint64_t> *out)
+        const;
+
+    /* the same, for the frozen index at frozen */
+    static bool frozen_candidates(
+        uint8_t const *frozen,
+        std::string const &needle,
+        std::vector<uint64_t> *out);
+
+    /* forget the blocks before block, freezing them into frozen
+     * unless it's nullptr */
+    void prune(uint64_t block, std::vector<uint8_t> *frozen=nullptr);
+
+    /* approximate memory used, in bytes */
+    size_t memory_usage(void) const;
+
+
+    TrigramIndex();
+};
+
+
+#endif
+
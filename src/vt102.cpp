@@ -7,36 +7,260 @@
  */
 
 #include "vt102.h"
+#include "trace.h"
+#include "parsestats.h"
 
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
 
+#include <algorithm>
 #include <stdexcept>
-#include <unordered_map>
+#include <array>
 
 
-bool VT102CONFIG_do_trace = false;
+bool VT102CONFIG_report_errors = false;
 
 
-#define TRACE(fmt, ...)             \
-    ({                              \
-        if (VT102CONFIG_do_trace)   \
-        {                           \
-            fprintf(                \
-                stderr,             \
-                "%s: " fmt "\n",    \
-                __func__,           \
-                ##__VA_ARGS__);     \
-        }                           \
-    })
+/* with tracing compiled out, the arguments aren't even evaluated */
+#ifdef VT102_TRACE
+#define TRACE(...) trace(__VA_ARGS__)
+#else
+#define TRACE(...) ((void)0)
+#endif
 
 
 
-void VT102::output(std::string message)
+/* get the font index of ch in the given charset */
+static constexpr uint8_t charset_fontidx(CharSet charset, unsigned char ch)
+{
+    uint8_t idx = 0;
+    switch (charset)
+    {
+    /* the only difference between the US and UK charsets are for '#',
+     * which renders as '#' in the US, and as the pound (currency)
+     * symbol in the UK */
+    case CharSet::UnitedStates:
+    case CharSet::UnitedKingdom:
+        switch (ch)
+        {
+        /* 1st and 2nd columns are control characters, so they don't
+         * render as anything, except for SUB, which draws the
+         * 'substitute character' */
+        case 0x1A:
+            idx = 16;
+            break;
+
+        case '#':
+            if (charset == CharSet::UnitedStates)
+            {
+                idx = 26;
+            }
+            else    /* UK */
+            {
+                idx = 113;
+            }
+            break;
+
+        default:
+            idx = (8 * ch) % 127;
+            break;
+        }
+        break;
+
+    case CharSet::Special:
+        switch (ch)
+        {
+        /* 1st and 2nd columns are control characters, so they don't
+         * render as anything, except for SUB, which draws the
+         * 'substitute character' */
+        case 0x1A:
+            idx = 16;
+            break;
+
+        case '_':
+            idx = 0;
+            break;
+
+        /* 7th column */
+        case '`':
+        case 'a' ... 'o':
+            idx = (8 + (8 * (ch - '`'))) % 127;
+            break;
+
+        /* 8th column */
+        case 'p' ... 'z':
+        case '{':
+        case '|':
+        case '}':
+        case '~':
+            idx = (9 + (8 * (ch - 'p'))) % 127;
+            break;
+
+        default:
+            idx = (8 * ch) % 127;
+            break;
+        }
+        break;
+
+    case CharSet::AltROM:
+    case CharSet::AltROMSpecial:
+        idx = (8 * ch) % 127;
+        break;
+    }
+    return idx;
+}
+
+/* charset_fontidx for every charset and character, so the
+ * lookup done when a character is written is a single load */
+static constexpr auto fontidx_table = []()
+{
+    std::array<std::array<uint8_t, 256>, 5> table{};
+    for (size_t charset = 0; charset < table.size(); ++charset)
+    {
+        for (size_t ch = 0; ch < table[charset].size(); ++ch)
+        {
+            table[charset][ch] = charset_fontidx((CharSet)charset, ch);
+        }
+    }
+    return table;
+}();
+
+
+/* the characters typed by the main keys */
+static constexpr struct
+{
+    VT102::Key key;
+    int chars[3];
+} key_bindings[] =\
+{
+    /* key
+     *                         unshifted
+     *                         |    shifted
+     *                         |    |    ctrl
+     *                         |    |    |
+     *                         v    v    v */
+    { VT102::Escape,       { 033, 033,  -1 } },
+
+    { VT102::KB_1,         { '1', '!',  -1 } },
+    { VT102::KB_2,         { '2', '@',  -1 } },
+    { VT102::KB_3,         { '3', '#',  -1 } },
+    { VT102::KB_4,         { '4', '$',  -1 } },
+    { VT102::KB_5,         { '5', '%',  -1 } },
+    { VT102::KB_6,         { '6', '^',  -1 } },
+    { VT102::KB_7,         { '7', '&',  -1 } },
+    { VT102::KB_8,         { '8', '*',  -1 } },
+    { VT102::KB_9,         { '9', '(',  -1 } },
+    { VT102::KB_0,         { '0', ')',  -1 } },
+    { VT102::Minus,        { '-', '_',  -1 } },
+    { VT102::Equals,       { '=', '+',  -1 } },
+    { VT102::Backtick,     { '`', '~', 036 } },
+    { VT102::Backspace,    {'\b','\b',  -1 } },
+
+    { VT102::Tab,          {'\t','\t',  -1 } },
+    { VT102::KB_Q,         { 'q', 'Q', 021 } },
+    { VT102::KB_W,         { 'w', 'W', 027 } },
+    { VT102::KB_E,         { 'e', 'E', 005 } },
+    { VT102::KB_R,         { 'r', 'R', 022 } },
+    { VT102::KB_T,         { 't', 'T', 024 } },
+    { VT102::KB_Y,         { 'y', 'Y', 031 } },
+    { VT102::KB_U,         { 'u', 'U', 025 } },
+    { VT102::KB_I,         { 'i', 'I', 011 } },
+    { VT102::KB_O,         { 'o', 'O', 017 } },
+    { VT102::KB_P,         { 'p', 'P', 020 } },
+    { VT102::LeftBracket,  { '[', '{', 033 } },
+    { VT102::RightBracket, { ']', '}', 035 } },
+    { VT102::Delete,       {0177,0177,  -1 } },
+
+    { VT102::KB_A,         { 'a', 'A', 001 } },
+    { VT102::KB_S,         { 's', 'S', 023 } },
+    { VT102::KB_D,         { 'd', 'D', 004 } },
+    { VT102::KB_F,         { 'f', 'F', 006 } },
+    { VT102::KB_G,         { 'g', 'G', 007 } },
+    { VT102::KB_H,         { 'h', 'H', 010 } },
+    { VT102::KB_J,         { 'j', 'J', 012 } },
+    { VT102::KB_K,         { 'k', 'K', 013 } },
+    { VT102::KB_L,         { 'l', 'L', 014 } },
+    { VT102::Semicolon,    { ';', ':',  -1 } },
+    { VT102::Quote,        { '\'','"',  -1 } },
+    { VT102::Backslash,    { '\\','|', 034 } },
+
+    { VT102::KB_Z,         { 'z', 'Z', 032 } },
+    { VT102::KB_X,         { 'x', 'X', 030 } },
+    { VT102::KB_C,         { 'c', 'C', 003 } },
+    { VT102::KB_V,         { 'v', 'V', 026 } },
+    { VT102::KB_B,         { 'b', 'B', 002 } },
+    { VT102::KB_N,         { 'n', 'N', 016 } },
+    { VT102::KB_M,         { 'm', 'M', 015 } },
+    { VT102::Comma,        { ',', '<',  -1 } },
+    { VT102::Period,       { '.', '>',  -1 } },
+    { VT102::Slash,        { '/', '?', 037 } },
+    { VT102::LineFeed,     {'\n','\n',  -1 } },
+
+    { VT102::Space,        { ' ', ' ', 000 } },
+};
+
+/* key_bindings indexed by key, -1 for keys which don't type anything */
+static constexpr auto key_chars = []()
+{
+    std::array<std::array<int, 3>, VT102::keys> table{};
+    for (std::array<int, 3> &chars : table)
+    {
+        chars = {{ -1, -1, -1 }};
+    }
+    for (auto const &binding : key_bindings)
+    {
+        table[binding.key] =\
+            {{ binding.chars[0], binding.chars[1], binding.chars[2] }};
+    }
+    return table;
+}();
+
+/* the final byte of the sequences sent by the cursor and PF keys */
+static constexpr auto key_finals = []()
+{
+    std::array<char, VT102::keys> table{};
+    table[VT102::Up] = 'A';
+    table[VT102::Down] = 'B';
+    table[VT102::Right] = 'C';
+    table[VT102::Left] = 'D';
+    table[VT102::PF1] = 'P';
+    table[VT102::PF2] = 'Q';
+    table[VT102::PF3] = 'R';
+    table[VT102::PF4] = 'S';
+    return table;
+}();
+
+/* what the keypad keys send in numeric and application mode */
+static constexpr auto keypad_chars = []()
+{
+    std::array<std::array<char, 2>, VT102::keys> table{};
+    table[VT102::KP_0]      = {{ '0', 'p' }};
+    table[VT102::KP_1]      = {{ '1', 'q' }};
+    table[VT102::KP_2]      = {{ '2', 'r' }};
+    table[VT102::KP_3]      = {{ '3', 's' }};
+    table[VT102::KP_4]      = {{ '4', 't' }};
+    table[VT102::KP_5]      = {{ '5', 'u' }};
+    table[VT102::KP_6]      = {{ '6', 'v' }};
+    table[VT102::KP_7]      = {{ '7', 'w' }};
+    table[VT102::KP_8]      = {{ '8', 'x' }};
+    table[VT102::KP_9]      = {{ '9', 'y' }};
+    table[VT102::KP_Minus]  = {{ '-', 'm' }};
+    table[VT102::KP_Comma]  = {{ ',', 'l' }};
+    table[VT102::KP_Period] = {{ '.', 'n' }};
+    return table;
+}();
+
+
+
+void VT102::output(std::string_view message)
 {
     if (xon)
     {
-        outbuffer += message;
+        outbuffer.append(message.data(), message.size());
+        /* the echo isn't from the host, so it's interpreted without
+         * counting it in the parse statistics */
         if (!SRM)
         {
             for (char ch : message)
@@ -62,23 +286,43 @@ void VT102::output(std::string message)
     }
 }
 
+bool VT102::flow_control(size_t backlog)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    /* XON/XOFF are put straight into the output: they're sent even
+     * while we're XOFF'd ourselves, and they're never echoed */
+    if (    !flow.xoff_sent
+        &&  setup.auto_XON_XOFF
+        &&  backlog >= flow.xoff_threshold)
+    {
+        TRACE(TraceOp::XOFF, backlog);
+        outbuffer += '\023';
+        flow.xoff_sent = true;
+        flow.xoff_episodes++;
+        flow.xoff_since = now;
+        return true;
+    }
+    /* turning auto XON/XOFF off in SET-UP releases the host too */
+    else if (   flow.xoff_sent
+             && (backlog <= flow.xon_threshold || !setup.auto_XON_XOFF))
+    {
+        TRACE(TraceOp::XON, backlog);
+        outbuffer += '\021';
+        flow.xoff_sent = false;
+        flow.xoff_time += now - flow.xoff_since;
+        return true;
+    }
+    return false;
+}
+
 void VT102::keyboard_input(Key key, unsigned int mod)
 {
     /* SET-UP answerback creation */
     if (state == State::CreateAnswerback)
     {
-        char ch = 0;
-        bool err = false;
-        try
-        {
-            ch = getkey(key, mod);
-        }
-        catch (std::invalid_argument &e)
-        {
-            err = true;
-        }
-
-        if (!err)
+        int const ch = getkey(key, mod);
+        if (ch != -1)
         {
             if (setup.delimiter == -1)
             {
@@ -94,33 +338,28 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             }
             else
             {
-                if (!err)
-                {
-                    answerback[setup.answerback_idx++] = ch;
+                answerback[setup.answerback_idx++] = ch;
 
-                    int tmp = single_shift;
-                    if (mod & Ctrl)
-                    {
-                        /* diamond character in the special charset */
-                        ch = 0x60;
-                        single_shift = 2;
-                    }
-                    putc(ch);
-                    single_shift = tmp;
-
-                    if (setup.answerback_idx >= 20)
-                    {
-                        setup.answerback_idx = 0;
-                        setup.delimiter = -1;
-                        state = State::SetUpB;
-                        curs_y = rows - 2;
-                        curs_x = 0;
-                    }
+                if (setup.answerback_idx >= 20)
+                {
+                    setup.answerback_idx = 0;
+                    setup.delimiter = -1;
+                    state = State::SetUpB;
+                    curs_y = rows - 2;
+                    curs_x = 0;
                 }
             }
         }
 
-        display_setup();
+        if (state == State::CreateAnswerback)
+        {
+            display_setup_answerback();
+        }
+        else
+        {
+            /* SET-UP B doesn't show the answerback */
+            screen[rows - 2] = blank_row();
+        }
         curs_x = 3 + (setup.delimiter != -1) + setup.answerback_idx;
         curs_y = rows - 2;
     }
@@ -140,6 +379,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             if (state == State::SetUpA)
             {
                 setup.tab_stops[curs_x] = !setup.tab_stops[curs_x];
+                display_setup_tab_stop(curs_x);
             }
             break;
 
@@ -151,21 +391,11 @@ void VT102::keyboard_input(Key key, unsigned int mod)
                 {
                     setup.tab_stops[x] = false;
                 }
+                display_setup_tab_stops();
             }
 
             /* characters displayed before entering SETUP are lost */
-            for (Line &line : saved_screen)
-            {
-                for (ssize_t x = 0; x < cols; ++x)
-                {
-                    line[x].ch = ' ';
-                    line[x].underline = false;
-                    line[x].reverse   = false;
-                    line[x].blink     = false;
-                    line[x].bold      = false;
-                    line[x].charset   = g[0];
-                }
-            }
+            std::fill(saved_screen.begin(), saved_screen.end(), blank_row());
             break;
 
         case KB_4:
@@ -183,105 +413,18 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             {
                 state = State::SetUpA;
             }
+            display_setup();
             break;
 
         case KB_6:
             /* toggle the selected feature */
             if (state == State::SetUpB)
             {
-                switch (curs_x)
+                bool *feature = setup_switch(curs_x);
+                if (feature)
                 {
-                /* 1 */
-                case 2:
-                    DECSCLM = !DECSCLM;
-                    break;
-                case 3:
-                    DECARM = !DECARM;
-                    break;
-                case 4:
-                    DECSCNM = !DECSCNM;
-                    break;
-                case 5:
-                    setup.block_cursor = !setup.block_cursor;
-                    break;
-
-                /* 2 */
-                case 10:
-                    setup.margin_bell = !setup.margin_bell;
-                    break;
-                case 11:
-                    setup.keyclick = !setup.keyclick;
-                    break;
-                case 12:
-                    DECANM = !DECANM;
-                    break;
-                case 13:
-                    setup.auto_XON_XOFF = !setup.auto_XON_XOFF;
-                    break;
-
-                /* 3 */
-                case 18:
-                    setup.UK_charset = !setup.UK_charset;
-                    break;
-                case 19:
-                    DECAWM = !DECAWM;
-                    break;
-                case 20:
-                    LNM = !LNM;
-                    break;
-                case 21:
-                    SRM = !SRM;
-                    break;
-
-                /* 4 */
-                case 26:
-                    DECPFF = !DECPFF;
-                    break;
-                case 27:
-                    DECPEX = !DECPEX;
-                    break;
-                case 28:
-                    setup.stop_bits = !setup.stop_bits;
-                    break;
-                case 29:
-                    setup.receive_parity = !setup.receive_parity;
-                    break;
-
-                /* 5 */
-                case 34:
-                    setup.break_enable = !setup.break_enable;
-                    break;
-                case 35:
-                    setup.disconn_char_enable =\
-                        !setup.disconn_char_enable;
-                    break;
-                case 36:
-                    setup.disconn_delay = !setup.disconn_delay;
-                    break;
-                case 37:
-                    setup.auto_answerback = !setup.auto_answerback;
-                    break;
-
-                /* 6 */
-                case 42:
-                    setup.initial_direction =\
-                        !setup.initial_direction;
-                    break;
-                case 43:
-                    setup.auto_turnaround = !setup.auto_turnaround;
-                    break;
-
-                /* 7 */
-                case 50:
-                    setup.power = !setup.power;
-                    break;
-                case 51:
-                    setup.wps_terminal_kbd = !setup.wps_terminal_kbd;
-                    break;
-
-                default:
-                    /* no feature selected */
-                    break;
+                    *feature = !*feature;
+                    display_setup_switch(curs_x);
                 }
             }
             break;
@@ -294,12 +437,14 @@ void VT102::keyboard_input(Key key, unsigned int mod)
                 {
                     setup.modem.tx_speed++;
                     setup.modem.tx_speed %= 16;
+                    display_setup_modem();
                 }
                 /* set tx speed for printer */
                 else
                 {
                     setup.printer.tx_rx_speed++;
                     setup.printer.tx_rx_speed %= 16;
+                    display_setup_printer();
                 }
             }
             break;
@@ -312,12 +457,14 @@ void VT102::keyboard_input(Key key, unsigned int mod)
                 {
                     setup.modem.rx_speed++;
                     setup.modem.rx_speed %= 16;
+                    display_setup_modem();
                 }
                 /* set rx speed for printer */
                 else
                 {
                     setup.printer.tx_rx_speed++;
                     setup.printer.tx_rx_speed %= 16;
+                    display_setup_printer();
                 }
             }
             break;
@@ -332,18 +479,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             setup = user_setup;
 
             /* characters displayed before entering SETUP are lost */
-            for (Line &line : saved_screen)
-            {
-                for (ssize_t x = 0; x < cols; ++x)
-                {
-                    line[x].ch = ' ';
-                    line[x].underline = false;
-                    line[x].reverse   = false;
-                    line[x].blink     = false;
-                    line[x].bold      = false;
-                    line[x].charset   = g[0];
-                }
-            }
+            std::fill(saved_screen.begin(), saved_screen.end(), blank_row());
 
             exit_setup();
             break;
@@ -369,6 +505,8 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             if (state == State::SetUpB && (mod & Shift))
             {
                 modem_features_selected = true;
+                display_setup_modem();
+                display_setup_printer();
             }
             /* move cursor left */
             else
@@ -385,6 +523,8 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             if (state == State::SetUpB && (mod & Shift))
             {
                 modem_features_selected = false;
+                display_setup_modem();
+                display_setup_printer();
             }
             /* move cursor right */
             else
@@ -402,6 +542,8 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             {
                 state = State::CreateAnswerback;
                 memset(answerback, 0, 20);
+                display_setup_answerback();
+                curs_x = 3;
             }
             break;
 
@@ -411,6 +553,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             {
                 setup.modem.turnaround_disconn_char++;
                 setup.modem.turnaround_disconn_char %= 5;
+                display_setup_modem();
             }
             break;
 
@@ -419,6 +562,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             if (mod & Shift)
             {
                 setup = Setup(cols);
+                display_setup_page();
             }
             break;
 
@@ -428,6 +572,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             {
                 setup.modem.control++;
                 setup.modem.control %= 5;
+                display_setup_modem();
             }
             break;
 
@@ -440,11 +585,13 @@ void VT102::keyboard_input(Key key, unsigned int mod)
                 {
                     setup.modem.data_parity_bits++;
                     setup.modem.data_parity_bits %= 8;
+                    display_setup_modem();
                 }
                 else
                 {
                     setup.printer.data_parity_bits++;
                     setup.printer.data_parity_bits %= 8;
+                    display_setup_printer();
                 }
             }
             break;
@@ -454,6 +601,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             if (mod & Shift)
             {
                 setup = user_setup;
+                display_setup_page();
             }
             break;
 
@@ -471,6 +619,10 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             {
                 setup.tab_stops[x] = (x != 0 && x % 8 == 0);
             }
+            if (state == State::SetUpA)
+            {
+                display_setup_tab_stops();
+            }
             break;
 
 
@@ -478,14 +630,6 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             /* other keys are ignored */
             break;
         }
-        if (key != SetUp && key != KB_0)
-        {
-            ssize_t x = curs_x,
-                    y = curs_y;
-            display_setup();
-            curs_x = (state == State::CreateAnswerback? 3 : x);
-            curs_y = y;
-        }
     }
     /* normal */
     else
@@ -503,27 +647,19 @@ void VT102::keyboard_input(Key key, unsigned int mod)
         case Left:
         case Right:
           {
-            std::unordered_map<Key, char> out =\
-            {
-                { Up,    'A'},
-                { Down,  'B'},
-                { Right, 'C'},
-                { Left,  'D'}
-            };
-            char msg[4] =\
+            char const msg[3] =\
             {
                 '\033', /* ESC */
                 DECCKM? 'O' : '[',
-                out[key],
-                '\0'
+                key_finals[key]
             };
-            output(std::string(msg));
+            output(std::string_view(msg, 3));
           } break;
 
         case Break:
             if (mod & Ctrl)
             {
-                output(std::string(answerback, 20));
+                output(std::string_view(answerback, 20));
             }
             break;
 
@@ -541,7 +677,7 @@ void VT102::keyboard_input(Key key, unsigned int mod)
             }
             else if (key == KP_Enter && keypad_mode == KPMode::Application)
             {
-                output("\0330M");
+                output("\033OM");
             }
             else
             {
@@ -566,21 +702,13 @@ void VT102::keyboard_input(Key key, unsigned int mod)
         case PF3:
         case PF4:
           {
-            std::unordered_map<Key, char> byte3 =\
-            {
-                { PF1, 'P' },
-                { PF2, 'Q' },
-                { PF3, 'R' },
-                { PF4, 'S' }
-            };
-            char out[4] =\
+            char const msg[3] =\
             {
                 '\033', /* ESC */
                 'O',
-                byte3[key],
-                '\0'
+                key_finals[key]
             };
-            output(std::string(out));
+            output(std::string_view(msg, 3));
           } break;
 
         case KP_0:
@@ -598,62 +726,27 @@ void VT102::keyboard_input(Key key, unsigned int mod)
         case KP_Period:
             if (keypad_mode == KPMode::Numeric)
             {
-                std::unordered_map<Key, char> out =\
-                {
-                    { KP_0,      '0' },
-                    { KP_1,      '1' },
-                    { KP_2,      '2' },
-                    { KP_3,      '3' },
-                    { KP_4,      '4' },
-                    { KP_5,      '5' },
-                    { KP_6,      '6' },
-                    { KP_7,      '7' },
-                    { KP_8,      '8' },
-                    { KP_9,      '9' },
-                    { KP_Minus,  '-' },
-                    { KP_Comma,  ',' },
-                    { KP_Period, '.' },
-                };
-                output(std::string(1, out[key]));
+                output(std::string_view(&keypad_chars[key][0], 1));
             }
             else
             {
-                std::unordered_map<Key, char> out =\
+                char const msg[3] =\
                 {
-                    { KP_0,      'p' },
-                    { KP_1,      'q' },
-                    { KP_2,      'r' },
-                    { KP_3,      's' },
-                    { KP_4,      't' },
-                    { KP_5,      'u' },
-                    { KP_6,      'v' },
-                    { KP_7,      'w' },
-                    { KP_8,      'x' },
-                    { KP_9,      'y' },
-                    { KP_Minus,  'm' },
-                    { KP_Comma,  'l' },
-                    { KP_Period, 'n' },
+                    '\033', /* ESC */
+                    'O',
+                    keypad_chars[key][1]
                 };
-                output("\0330" + std::string(1, out[key]));
+                output(std::string_view(msg, 3));
             }
             break;
 
         default:
           {
-            bool err = false;
-            char out = 0;
-            try
+            int const ch = getkey(key, mod);
+            if (ch != -1)
             {
-                out = getkey(key, mod);
-            }
-            catch (std::invalid_argument &e)
-            {
-                err = true;
-            }
-
-            if (!err)
-            {
-                output(std::string(1, out));
+                char const msg = ch;
+                output(std::string_view(&msg, 1));
             }
           } break;
         }
@@ -661,77 +754,155 @@ void VT102::keyboard_input(Key key, unsigned int mod)
 }
 
 
-void VT102::interpret_byte(uint8_t ch)
+/* the largest value a control sequence parameter can have */
+static int const PARAM_MAX = 16383;
+
+/* read parameter idx of a control sequence into out, a missing or
+ * empty parameter is def; fails if it isn't a number */
+static bool get_param(
+    ControlSequence const *cmd,
+    size_t idx,
+    int def,
+    int *out)
+{
+    if (idx >= cmd->params.size() || cmd->params[idx].empty())
+    {
+        *out = def;
+        return true;
+    }
+
+    int value = 0;
+    for (char ch : cmd->params[idx])
+    {
+        if (ch < '0' || ch > '9')
+        {
+            return false;
+        }
+        /* clamped, so it can't overflow */
+        value = std::min(value * 10 + (ch - '0'), PARAM_MAX);
+    }
+    *out = value;
+    return true;
+}
+
+/* read the first count parameters of a control sequence, fails if
+ * there are more than that or any of them aren't numbers */
+static bool get_params(
+    ControlSequence const *cmd,
+    size_t count,
+    int def,
+    int *out)
+{
+    if (cmd->params.size() > count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!get_param(cmd, i, def, out + i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static_assert(
+    (size_t)VT102::State::CreateAnswerback + 1 == PARSE_STATES,
+    "PARSE_STATES must match VT102::State");
+
+VT102::Error VT102::interpret_byte(uint8_t ch)
 {
+#ifdef VT102_TRACE
+    trace_byte(ch, (uint8_t)state);
+#endif
+    Error status = Error::None;
     switch (state)
     {
     case State::Normal:
-        interpret_byte_control_character(ch);
+        status = interpret_byte_control_character(ch);
         break;
 
 
     case State::Escape:
-        interpret_byte_escape(ch);
+        status = interpret_byte_escape(ch);
         break;
 
 
     case State::CtrlSeq:
-        interpret_byte_ctrlseq(ch);
+        status = interpret_byte_ctrlseq(ch);
         break;
 
     case State::Pound:
+        /* the cursor can be below the bottom line, waiting to wrap or
+         * moved there by CUP, the line attributes go on the bottom line
+         * then */
         switch (ch)
         {
         /* DECDHL: upper half double-height double-width */
         case '3':
-            TRACE("DECDHL upper");
-            screen[curs_y].attr = Line::DOUBLE_HEIGHT_UPPER;
+            TRACE(TraceOp::DECDHL_TOP);
+            edit_line(std::min(curs_y, rows - 1)).attr =\
+                Line::DOUBLE_HEIGHT_UPPER;
             break;
 
         /* DECDHL: lower half double-height double-width */
         case '4':
-            TRACE("DECDHL lower");
-            screen[curs_y].attr = Line::DOUBLE_HEIGHT_LOWER;
+            TRACE(TraceOp::DECDHL_BOTTOM);
+            edit_line(std::min(curs_y, rows - 1)).attr =\
+                Line::DOUBLE_HEIGHT_LOWER;
             break;
 
         /* DECSWL: single-height single-width */
         case '5':
-            TRACE("DECSWL");
-            screen[curs_y].attr = Line::NORMAL;
+            TRACE(TraceOp::DECSWL);
+            edit_line(std::min(curs_y, rows - 1)).attr =\
+                Line::NORMAL;
             break;
 
         /* DECDWL: single-height double-width */
         case '6':
-            TRACE("DECDWL");
-            screen[curs_y].attr = Line::DOUBLE_WIDTH;
+            TRACE(TraceOp::DECDWL);
+            edit_line(std::min(curs_y, rows - 1)).attr =\
+                Line::DOUBLE_WIDTH;
             break;
 
         /* DECALN */
         case '8':
-            TRACE("DECALN");
+          {
+            TRACE(TraceOp::DECALN);
+            /* fill the screen with 'E's, as putc would write them */
+            Char const e =\
+            {
+                'E',
+                (bool)(char_attributes & UNDERLINE),
+                (bool)(char_attributes & REVERSE),
+                (bool)(char_attributes & BLINK),
+                (bool)(char_attributes & BOLD),
+                g[current_charset],
+                (uint8_t)fontidx(g[current_charset], 'E')
+            };
             for (ssize_t y = 0; y < rows; ++y)
             {
-                for (ssize_t x = 0; x < cols; ++x)
-                {
-                    curs_x = x;
-                    curs_y = y;
-                    this->putc('E');
-                }
+                Line &line = edit_line(y);
+                std::fill(line.chars.begin(), line.chars.end(), e);
             }
-            break;
+            /* and the cursor goes home, rather than off the end */
+            curs_x = 0;
+            curs_y = 0;
+          } break;
 
 
         default:
-            throw std::runtime_error(
-                "undefined escape sequence `ESC # "
-                + std::string(1, ch)
-                + "`");
+            status = error(Error::UnknownEscape, "ESC #", ch);
+            break;
         }
         state = State::Normal;
         break;
 
     case State::G0SetSelect:
-        TRACE("G0 select '%c'", ch);
+        TRACE(TraceOp::SCS_G0, ch);
         switch (ch)
         {
         case 'A':
@@ -751,17 +922,14 @@ void VT102::interpret_byte(uint8_t ch)
             break;
 
         default:
-            throw std::runtime_error(
-                "undefined escape sequence `ESC ( "
-                + std::to_string(ch)
-                + "`");
+            status = error(Error::UnknownEscape, "ESC (", ch);
             break;
         }
         state = State::Normal;
         break;
 
     case State::G1SetSelect:
-        TRACE("G1 select '%c'", ch);
+        TRACE(TraceOp::SCS_G1, ch);
         switch (ch)
         {
         case 'A':
@@ -781,10 +949,7 @@ void VT102::interpret_byte(uint8_t ch)
             break;
 
         default:
-            throw std::runtime_error(
-                "undefined escape sequence `ESC ) "
-                + std::string(1, ch)
-                + "`");
+            status = error(Error::UnknownEscape, "ESC )", ch);
             break;
         }
         state = State::Normal;
@@ -796,48 +961,143 @@ void VT102::interpret_byte(uint8_t ch)
         /* in SETUP mode, incoming computer characters are ignored */
         break;
     }
+    return status;
+}
+
+void VT102::interpret_bytes(uint8_t const *bytes, size_t size)
+{
+    ParseStats &stats = parse_stats();
+    /* bytes per state are counted here and added to the thread's
+     * counters once, rather than a byte at a time */
+    uint64_t state_bytes[PARSE_STATES] = {};
+    size_t run = printable_run;
+    /* errors have already been counted (and reported) */
+    for (size_t i = 0; i < size; ++i)
+    {
+        uint8_t const ch = bytes[i];
+        state_bytes[(size_t)state] += 1;
+        if (state == State::Normal && ch >= 0x20 && ch != 0x7F)
+        {
+            run += 1;
+        }
+        /* anything else ends a run of printable characters */
+        else if (run != 0)
+        {
+            ParseStats::add(stats.printable_run, run);
+            run = 0;
+        }
+        interpret_byte(ch);
+    }
+    printable_run = run;
+
+    for (size_t i = 0; i < PARSE_STATES; ++i)
+    {
+        if (state_bytes[i] != 0)
+        {
+            stats.bytes[i].add(state_bytes[i]);
+        }
+    }
+}
+
+VT102::Error VT102::error(Error kind, char const *what, uint8_t ch)
+{
+    errors[(size_t)kind] += 1;
+    if (!VT102CONFIG_report_errors)
+    {
+        return kind;
+    }
+
+    /* the whole control sequence, or just the byte which was wrong */
+    std::string sequence;
+    if (cmd != nullptr && cmd->final != 0)
+    {
+        sequence = "ESC [";
+        for (size_t i = 0; i < cmd->params.size(); ++i)
+        {
+            /* the private parameter marker isn't separated */
+            sequence += (i == 0)? " "
+                : (cmd->params[i - 1] == "?")? ""
+                : ";";
+            sequence += cmd->params[i];
+        }
+        sequence += " " + cmd->intermediate + (char)cmd->final;
+    }
+    else
+    {
+        char byte[8];
+        snprintf(byte, sizeof(byte), "0x%02x", ch);
+        sequence = byte;
+    }
+    fprintf(
+        stderr,
+        "vt102: %s: %s `%s`\n",
+        error_name(kind),
+        what,
+        sequence.c_str());
+    return kind;
+}
+
+char const *VT102::error_name(Error kind)
+{
+    switch (kind)
+    {
+    case Error::None:
+        return "no error";
+    case Error::UnknownEscape:
+        return "unknown escape sequence";
+    case Error::UnknownControlSequence:
+        return "unknown control sequence";
+    case Error::UnknownParameter:
+        return "unknown parameter";
+    case Error::BadParameters:
+        return "bad parameters";
+    case Error::Unimplemented:
+        return "not implemented";
+    }
+    return "?";
 }
 
-void VT102::interpret_byte_control_character(uint8_t ch)
+VT102::Error VT102::interpret_byte_control_character(uint8_t ch)
 {
+    Error status = Error::None;
     switch (ch)
     {
     /* NUL */
     case '\000':
         /* ignored */
-        TRACE("NUL");
+        TRACE(TraceOp::NUL);
         break;
 
     /* ETX */
     case '\003':
         /* TODO: selectable as half-duplex turnaround */
-        TRACE("ETX");
-        throw std::runtime_error("ETX not implemented");
+        TRACE(TraceOp::ETX);
+        status = error(Error::Unimplemented, "ETX", ch);
         break;
 
     /* EOT */
     case '\004':
         /* TODO: selectable as half-duplex turnaround or disconnect */
-        TRACE("EOT");
-        throw std::runtime_error("EOT not implemented");
+        TRACE(TraceOp::EOT);
+        status = error(Error::Unimplemented, "EOT", ch);
         break;
 
     /* ENQ */
     case '\005':
-        TRACE("ENQ");
-        output(std::string(answerback));
+        TRACE(TraceOp::ENQ);
+        output(std::string_view(answerback, strnlen(answerback, 20)));
         break;
 
     /* BEL */
     case '\a':
         /* TODO: beep */
-        TRACE("BEL");
+        TRACE(TraceOp::BEL);
         puts("boop");
         break;
 
     /* BS */
     case '\b':
-        TRACE("BS");
+        TRACE(TraceOp::BS);
         if (curs_x - 1 >= 0)
         {
             curs_x -= 1;
@@ -847,7 +1107,7 @@ void VT102::interpret_byte_control_character(uint8_t ch)
     /* HT */
     case '\t':
       {
-        TRACE("HT");
+        TRACE(TraceOp::HT);
         ssize_t tmp = curs_x;
         /* HT moves the cursor to the next tab stop,
          * or to the right margin if there are no more tab stops */
@@ -866,10 +1126,10 @@ void VT102::interpret_byte_control_character(uint8_t ch)
     case '\n':
     case '\v':
     case '\f':
-        TRACE("%s",
+        TRACE(
             (ch == '\n' || ch == '\v')
-                ? (ch == '\n')? "LF" : "VT"
-                : "FF");
+                ? (ch == '\n')? TraceOp::LF : TraceOp::VT
+                : TraceOp::FF);
         /* TODO: proper movement (scrolling, etc.) */
         /* if LNM is set, LF moves to the next line AND
          * moves to column 0 */
@@ -890,26 +1150,26 @@ void VT102::interpret_byte_control_character(uint8_t ch)
 
     /* CR */
     case '\r':
-        TRACE("CR");
+        TRACE(TraceOp::CR);
         curs_x = 0;
         /* TODO: can be selected as half-duplex turnaround */
         break;
 
     /* SO */
     case '\016':
-        TRACE("SO");
+        TRACE(TraceOp::SO);
         current_charset = 1;
         break;
 
     /* SI */
     case '\017':
-        TRACE("SI");
+        TRACE(TraceOp::SI);
         current_charset = 0;
         break;
 
     /* DC1 */
     case '\021':
-        TRACE("DC1");
+        TRACE(TraceOp::DC1);
         if (setup.auto_XON_XOFF)
         {
             xon = true;
@@ -919,7 +1179,7 @@ void VT102::interpret_byte_control_character(uint8_t ch)
     /* DC3 */
     case '\023':
         /* TODO: can be selected as half-duplex turnaround */
-        TRACE("DC3");
+        TRACE(TraceOp::DC3);
         if (setup.auto_XON_XOFF)
         {
             xon = false;
@@ -929,7 +1189,7 @@ void VT102::interpret_byte_control_character(uint8_t ch)
     /* CAN, SUB */
     case '\030':
     case '\032':
-        TRACE("%s", ch == '\030'? "CAN" : "SUB");
+        TRACE(ch == '\030'? TraceOp::CAN : TraceOp::SUB);
         if (state == State::Escape || state == State::CtrlSeq)
         {
             state = State::Normal;
@@ -941,40 +1201,42 @@ void VT102::interpret_byte_control_character(uint8_t ch)
 
     /* ESC */
     case '\033':
-        TRACE("ESC");
+        TRACE(TraceOp::ESC);
         state = State::Escape;
         break;
 
     /* DEL */
     case '\177':
         /* ignored */
-        TRACE("DEL");
+        TRACE(TraceOp::DEL);
         break;
 
 
     /* normal character */
     default:
-        TRACE("%c", ch);
+        TRACE(TraceOp::CHAR, ch);
         this->putc(ch);
         break;
     }
+    return status;
 }
 
-void VT102::interpret_byte_escape(uint8_t ch)
+VT102::Error VT102::interpret_byte_escape(uint8_t ch)
 {
+    Error status = Error::None;
     state = State::Normal;
     switch (ch)
     {
     /* RIS */
     case 'c':
         /* TODO: reset (leave this unimplemented?) */
-        TRACE("RIS");
-        throw std::runtime_error("RIS not implemented");
+        TRACE(TraceOp::RIS);
+        status = error(Error::Unimplemented, "RIS", ch);
         break;
 
     /* IND */
     case 'D':
-        TRACE("IND");
+        TRACE(TraceOp::IND);
         curs_y += 1;
         if (curs_y > scroll_bottom)
         {
@@ -984,7 +1246,7 @@ void VT102::interpret_byte_escape(uint8_t ch)
 
     /* NEL */
     case 'E':
-        TRACE("NEL");
+        TRACE(TraceOp::NEL);
         curs_x = 0;
         curs_y += 1;
         if (curs_y > scroll_bottom)
@@ -995,13 +1257,13 @@ void VT102::interpret_byte_escape(uint8_t ch)
 
     /* HTS */
     case 'H':
-        TRACE("HTS");
+        TRACE(TraceOp::HTS);
         setup.tab_stops[curs_x] = true;
         break;
 
     /* RI */
     case 'M':
-        TRACE("RI");
+        TRACE(TraceOp::RI);
         curs_y -= 1;
         if (curs_y < scroll_top)
         {
@@ -1011,25 +1273,25 @@ void VT102::interpret_byte_escape(uint8_t ch)
 
     /* SS2 */
     case 'N':
-        TRACE("SS2");
+        TRACE(TraceOp::SS2);
         single_shift = 2;
         break;
 
     /* DECID */
     case 'Z':
-        TRACE("DECID");
+        TRACE(TraceOp::DECID);
         output("\033[?6c");
         break;
 
     /* SS3 */
     case '0':
-        TRACE("SS3");
+        TRACE(TraceOp::SS3);
         single_shift = 3;
         break;
 
     /* DECSC */
     case '7':
-        TRACE("DECSC");
+        TRACE(TraceOp::DECSC);
         /* save cursor position, character attribute, charset,
          * and origin mode */
         if (saved == nullptr)
@@ -1048,7 +1310,7 @@ void VT102::interpret_byte_escape(uint8_t ch)
 
     /* DECRC */
     case '8':
-        TRACE("DECRC");
+        TRACE(TraceOp::DECRC);
         /* restore previously saved state, or reset cursor to home
          * position if there is no saved state */
         if (saved == nullptr)
@@ -1069,7 +1331,9 @@ void VT102::interpret_byte_escape(uint8_t ch)
 
     /* CSI */
     case '[':
-        TRACE("CSI");
+        TRACE(TraceOp::CSI);
+        /* a sequence which was cut off by this one is dropped */
+        delete cmd;
         cmd = new ControlSequence();
         state = State::CtrlSeq;
         break;
@@ -1100,16 +1364,15 @@ void VT102::interpret_byte_escape(uint8_t ch)
         break;
 
     default:
-        throw std::runtime_error(
-            "undefined escape sequence `ESC "
-            + std::to_string(ch)
-            + "`");
+        status = error(Error::UnknownEscape, "ESC", ch);
         break;
     }
+    return status;
 }
 
-void VT102::interpret_byte_ctrlseq(uint8_t ch)
+VT102::Error VT102::interpret_byte_ctrlseq(uint8_t ch)
 {
+    Error status = Error::None;
     switch (ch)
     {
     /* Intermediate Byte */
@@ -1154,6 +1417,7 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
     case 0x40 ... 0x7E:
         state = State::Normal;
         cmd->final = ch;
+        parse_stats().csi[ch - 0x40].add(1);
         /* ECMA-48 only defines control sequences with
          * either 1 or 0 intermediate bytes */
         if (cmd->intermediate.size() == 0)
@@ -1164,24 +1428,16 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'A':
               {
                 int delta = 1;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 1, &delta))
                 {
-                case 0:
-                    delta = 1;
-                    break;
-                case 1:
-                    delta = std::stoi(cmd->params[0]);
-                    break;
-                default:
-                    throw std::runtime_error(
-                        "CUU takes up to 1 parameter");
+                    status = error(Error::BadParameters, "CUU", ch);
                     break;
                 }
                 if (curs_y - delta < scroll_top)
                 {
                     delta = curs_y - scroll_top;
                 }
-                TRACE("CUU %d", delta);
+                TRACE(TraceOp::CUU, delta);
                 move_curs(curs_x, curs_y - delta);
               } break;
 
@@ -1189,24 +1445,16 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'B':
               {
                 int delta = 1;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 1, &delta))
                 {
-                case 0:
-                    delta = 1;
-                    break;
-                case 1:
-                    delta = std::stoi(cmd->params[0]);
-                    break;
-                default:
-                    throw std::runtime_error(
-                        "CUD takes up to 1 parameter");
+                    status = error(Error::BadParameters, "CUD", ch);
                     break;
                 }
                 if (curs_y + delta > scroll_bottom)
                 {
                     delta = scroll_bottom - curs_y;
                 }
-                TRACE("CUD %d", delta);
+                TRACE(TraceOp::CUD, delta);
                 move_curs(curs_x, curs_y + delta);
               } break;
 
@@ -1214,24 +1462,16 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'C':
               {
                 int delta = 1;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 1, &delta))
                 {
-                case 0:
-                    delta = 1;
-                    break;
-                case 1:
-                    delta = std::stoi(cmd->params[0]);
-                    break;
-                default:
-                    throw std::runtime_error(
-                        "CUF takes up to 1 parameter");
+                    status = error(Error::BadParameters, "CUF", ch);
                     break;
                 }
                 if (curs_x + delta >= cols)
                 {
                     delta = (curs_x + delta) - (cols - 1);
                 }
-                TRACE("CUF %d", delta);
+                TRACE(TraceOp::CUF, delta);
                 move_curs(curs_x + delta, curs_y);
               } break;
 
@@ -1239,24 +1479,16 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'D':
               {
                 int delta = 1;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 1, &delta))
                 {
-                case 0:
-                    delta = 1;
-                    break;
-                case 1:
-                    delta = std::stoi(cmd->params[0]);
-                    break;
-                default:
-                    throw std::runtime_error(
-                        "CUB takes up to 1 parameter");
+                    status = error(Error::BadParameters, "CUB", ch);
                     break;
                 }
                 if (curs_x - delta < 0)
                 {
                     delta = curs_x;
                 }
-                TRACE("CUB %d", delta);
+                TRACE(TraceOp::CUB, delta);
                 move_curs(curs_x - delta, curs_y);
               } break;
 
@@ -1264,45 +1496,22 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'H':
             case 'f':
               {
-                int newx = 0,
-                    newy = 0;
-                switch (cmd->params.size())
+                int args[2] = { 1, 1 };
+                if (!get_params(cmd, 2, 1, args))
                 {
-                case 0:
-                    newx = 0;
-                    newy = 0;
-                    break;
-                case 2:
-                    if (cmd->params[1] != "")
-                    {
-                        newx = std::stoi(cmd->params[1]) - 1;
-                    }
-                    else
-                    {
-                        newx = 0;
-                    }
-                /* intentional fallthrough */
-                case 1:
-                    if (cmd->params[0] != "")
-                    {
-                        newy = std::stoi(cmd->params[0]) - 1;
-                    }
-                    else
-                    {
-                        newy = 0;
-                    }
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        std::string((ch == 'H')? "CUP" : "HVP")
-                        + "takes up to 2 parameters");
+                    status = error(
+                        Error::BadParameters,
+                        (ch == 'H')? "CUP" : "HVP",
+                        ch);
                     break;
                 }
-                TRACE("%s %d %d",
-                    ch == 'H'? "CUP" : "HVP",
-                    newx,
-                    newy);
+                /* 0 is the same as 1, the first line or column */
+                int newx = std::max(args[1], 1) - 1,
+                    newy = std::max(args[0], 1) - 1;
+                TRACE(
+                    ch == 'H'? TraceOp::CUP : TraceOp::HVP,
+                    newy + 1,
+                    newx + 1);
                 /* IMPORTANT:
                  *  move_curs is not used here intentionally,
                  *  because CUP and HVP allow the cursor to be
@@ -1342,68 +1551,61 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'J':
               {
                 int arg = 0;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 0, &arg))
                 {
-                case 0:
-                    arg = 0;
-                    break;
-                case 1:
-                    arg = std::stoi(cmd->params[0]);
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "ED takes up to 1 parameter");
+                    status = error(Error::BadParameters, "ED", ch);
                     break;
                 }
+                if (0 <= arg && arg <= 2)
+                {
+                    /* cells erased, the cursor can be below the
+                     * bottom line */
+                    ssize_t const y = std::min(curs_y, rows),
+                                  cells =\
+                        (arg == 0)? (rows - y) * cols - curs_x
+                        : (arg == 1)? y * cols + curs_x + 1
+                        : rows * cols;
+                    ParseStats &stats = parse_stats();
+                    stats.ed[arg].add(1);
+                    ParseStats::add(
+                        stats.ed_cells,
+                        std::max<ssize_t>(cells, 0));
+                }
                 switch (arg)
                 {
                 case 0:
                     /* erase from cursor to end of screen */
-                    TRACE("ED curs to end of screen");
+                    TRACE(TraceOp::ED, arg);
                     for (ssize_t y = curs_y; y < rows; ++y)
                     {
-                        for (
-                            ssize_t x = (y == curs_y? curs_x : 0);
-                            x < cols;
-                            ++x)
-                        {
-                            erase(x, y);
-                        }
-                        screen[y].attr = Line::NORMAL;
+                        erase((y == curs_y)? curs_x : 0, cols, y);
+                        edit_line(y).attr = Line::NORMAL;
                     }
                     break;
                 case 1:
                     /* erase from start of screen to cursor */
-                    TRACE("ED start of screen to curs");
-                    for (ssize_t y = 0; y <= curs_y; ++y)
+                    TRACE(TraceOp::ED, arg);
+                    for (
+                        ssize_t y = 0;
+                        y <= std::min(curs_y, rows - 1);
+                        ++y)
                     {
-                        for (
-                            ssize_t x = 0;
-                            x <= (y == curs_y? curs_x : cols);
-                            ++x)
-                        {
-                            erase(x, y);
-                        }
-                        screen[y].attr = Line::NORMAL;
+                        erase(0, (y == curs_y)? curs_x + 1 : cols, y);
+                        edit_line(y).attr = Line::NORMAL;
                     }
                     break;
                 case 2:
                     /* erase entire display */
-                    TRACE("ED entire display");
+                    TRACE(TraceOp::ED, arg);
                     for (ssize_t y = 0; y < rows; ++y)
                     {
-                        for (ssize_t x = 0; x < cols; ++x)
-                        {
-                            erase(x, y);
-                        }
-                        screen[y].attr = Line::NORMAL;
+                        erase(0, cols, y);
+                        edit_line(y).attr = Line::NORMAL;
                     }
                     break;
 
                 default:
-                    throw std::runtime_error(
-                        "ED only accepts 1,2, or 3 as a parameter");
+                    status = error(Error::UnknownParameter, "ED", ch);
                     break;
                 }
               } break;
@@ -1412,50 +1614,41 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'K':
               {
                 int arg = 0;
-                switch (cmd->params.size())
+                if (!get_params(cmd, 1, 0, &arg))
                 {
-                case 0:
-                    arg = 0;
-                    break;
-                case 1:
-                    arg = std::stoi(cmd->params[0]);
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "EL takes up to 1 parameter");
+                    status = error(Error::BadParameters, "EL", ch);
                     break;
                 }
+                if (0 <= arg && arg <= 2)
+                {
+                    ParseStats &stats = parse_stats();
+                    stats.el[arg].add(1);
+                    ParseStats::add(
+                        stats.el_cells,
+                        (arg == 0)? cols - curs_x
+                        : (arg == 1)? curs_x + 1
+                        : cols);
+                }
                 switch (arg)
                 {
                 case 0:
                     /* erase from cursor to end of line */
-                    TRACE("EL curs to end of line");
-                    for (ssize_t i = curs_x; i < cols; ++i)
-                    {
-                        erase(i, curs_y);
-                    }
+                    TRACE(TraceOp::EL, arg);
+                    erase(curs_x, cols, curs_y);
                     break;
                 case 1:
                     /* erase from start of line to cursor */
-                    TRACE("EL start of line to cursor");
-                    for (ssize_t i = 0; i <= curs_x; ++i)
-                    {
-                        erase(i, curs_y);
-                    }
+                    TRACE(TraceOp::EL, arg);
+                    erase(0, curs_x + 1, curs_y);
                     break;
                 case 2:
                     /* erase entire line */
-                    TRACE("EL entire line");
-                    for (ssize_t i = 0; i < cols; ++i)
-                    {
-                        erase(i, curs_y);
-                    }
+                    TRACE(TraceOp::EL, arg);
+                    erase(0, cols, curs_y);
                     break;
 
                 default:
-                    throw std::runtime_error(
-                        "EL only accepts 0, 1 or 2 as a parameter");
+                    status = error(Error::UnknownParameter, "EL", ch);
                     break;
                 }
               } break;
@@ -1464,30 +1657,18 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'L':
               {
                 /* insert N blank lines (default 1) */
-                int arg = 0;
-                switch (cmd->params.size())
+                int arg = 1;
+                if (!get_params(cmd, 1, 1, &arg))
                 {
-                case 0:
-                    arg = 1;
-                    break;
-                case 1:
-                    arg = std::stoi(cmd->params[0]);
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "IL takes up to 1 parameter");
+                    status = error(Error::BadParameters, "IL", ch);
                     break;
                 }
-                TRACE("IL %d", arg);
+                TRACE(TraceOp::IL, arg);
                 /* this sequence is ignored when the cursor is
                  * outside the scrolling region */
                 if (scroll_top <= curs_y && curs_y <= scroll_bottom)
                 {
-                    for (int i = 0; i < arg; ++i)
-                    {
-                        ins_line(curs_y);
-                    }
+                    ins_lines(curs_y, arg);
                 }
               } break;
 
@@ -1495,30 +1676,18 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'M':
               {
                 /* delete N lines (default 1) */
-                int arg = 0;
-                switch (cmd->params.size())
+                int arg = 1;
+                if (!get_params(cmd, 1, 1, &arg))
                 {
-                case 0:
-                    arg = 1;
-                    break;
-                case 1:
-                    arg = std::stoi(cmd->params[0]);
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "DL takes up to 1 parameter");
+                    status = error(Error::BadParameters, "DL", ch);
                     break;
                 }
-                TRACE("DL %d", arg);
+                TRACE(TraceOp::DL, arg);
                 /* this sequence is ignored when the cursor is
                  * outside the scrolling region */
                 if (scroll_top <= curs_y && curs_y <= scroll_bottom)
                 {
-                    for (int i = 0; i < arg; ++i)
-                    {
-                        del_line(curs_y);
-                    }
+                    del_lines(curs_y, arg);
                 }
               } break;
 
@@ -1526,31 +1695,19 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'P':
               {
                 /* delete N characters */
-                int arg = 0;
-                switch (cmd->params.size())
+                int arg = 1;
+                if (!get_params(cmd, 1, 1, &arg))
                 {
-                case 0:
-                    arg = 1;
+                    status = error(Error::BadParameters, "DCH", ch);
                     break;
-                case 1:
-                    arg = std::stoi(cmd->params[0]);
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "DCH takes up to 1 parameter");
-                    break;
-                }
-                TRACE("DCH %d", arg);
-                for (int i = 0; i < arg; ++i)
-                {
-                    del_char(curs_x, curs_y);
                 }
+                TRACE(TraceOp::DCH, arg);
+                del_chars(curs_x, std::min(curs_y, rows - 1), arg);
               } break;
 
             /* DA */
             case 'c':
-                TRACE("DA");
+                TRACE(TraceOp::DA);
                 output("\033[?6c");
                 break;
 
@@ -1560,20 +1717,20 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
                 {
                 /* clear tab stop at current position */
                 case 0:
-                    TRACE("TBC current position");
+                    TRACE(TraceOp::TBC, 0);
                     setup.tab_stops[curs_x] = false;
                     break;
                 case 1:
                     if (cmd->params[0] == "0")
                     {
                         /* clear tab stop at current position */
-                        TRACE("TBC current position");
+                        TRACE(TraceOp::TBC, 0);
                         setup.tab_stops[curs_x] = false;
                     }
                     else if (cmd->params[0] == "3")
                     {
                         /* clear all tab stops */
-                        TRACE("TBC all");
+                        TRACE(TraceOp::TBC, 3);
                         for (
                             size_t x = 0;
                             x < setup.tab_stops.size();
@@ -1590,8 +1747,7 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
                     break;
 
                 default:
-                    throw std::runtime_error(
-                        "TBC takes up to 1 parameter");
+                    status = error(Error::BadParameters, "TBC", ch);
                     break;
                 }
                 break;
@@ -1601,261 +1757,253 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
             case 'l':
               {
                 bool setting = cmd->final == 'h';
-                if (cmd->params.size() == 1)
+                /* DEC private modes start with a '?' */
+                bool const dec = (
+                       cmd->params.size() > 0
+                    && cmd->params[0] == "?");
+                char const *name = setting? "SM" : "RM";
+                if (cmd->params.size() == (dec? 1 : 0))
                 {
-                    int mode = std::stoi(cmd->params[0]);
-                    switch (mode)
-                    {
-                    case 2:
-                        TRACE("%cM KAM", ch == 'h'? 'S' : 'R');
-                        KAM = setting;
-                        break;
-                    case 4:
-                        TRACE("%cM IRM", ch == 'h'? 'S' : 'R');
-                        IRM = setting;
-                        break;
-                    case 12:
-                        TRACE("%cM SRM", ch == 'h'? 'S' : 'R');
-                        SRM = setting;
-                        break;
-                    case 20:
-                        TRACE("%cM LNM", ch == 'h'? 'S' : 'R');
-                        LNM = setting;
-                        break;
-
-                    default:
-                        throw std::runtime_error(
-                            std::string(setting? "S" : "R")
-                            + std::string(
-                                "M received undefined parameter ")
-                            + cmd->params[0]);
-                        break;
-                    }
+                    status = error(Error::BadParameters, name, ch);
+                    break;
                 }
-                else if (cmd->params.size() == 2)
+                /* modes which aren't recognised are ignored, the
+                 * rest are still set/reset */
+                for (size_t i = dec; i < cmd->params.size(); ++i)
                 {
-                    if (cmd->params[0] == "?")
+                    int mode = 0;
+                    if (!get_param(cmd, i, 0, &mode))
+                    {
+                        status = error(Error::BadParameters, name, ch);
+                        continue;
+                    }
+                    TRACE(
+                        dec
+                            ? setting? TraceOp::DECSM : TraceOp::DECRM
+                            : setting? TraceOp::SM : TraceOp::RM,
+                        mode);
+                    if (!dec)
                     {
-                        int mode = std::stoi(cmd->params[1]);
                         switch (mode)
                         {
-                        case 1:
-                            TRACE("%cM DECCKM", ch == 'h'? 'S' : 'R');
-                            /* when the keypad is in Numeric mode,
-                             * DECCKM is always reset */
-                            if (keypad_mode == KPMode::Numeric)
-                            {
-                                DECCKM = false;
-                            }
-                            else
-                            {
-                                DECCKM = setting;
-                            }
-                            break;
                         case 2:
-                            TRACE("%cM DECANM", ch == 'h'? 'S' : 'R');
-                            if (!setting)
-                            {
-                                DECANM = true;
-                                throw std::runtime_error(
-                                    "VT52 compatibility mode"
-                                    "unimplemented!");
-                            }
-                            break;
-                        case 3:
-                            TRACE("%cM DECCOLM",
-                                ch == 'h'? 'S' : 'R');
-                            DECCOLM = setting;
-                            if (cols < (setting? 132 : 80))
-                            {
-                                resize(setting? 132 : 80, rows);
-                            }
-                            /* when the columns per line is changed,
-                             * the screen is erased */
-                            for (ssize_t y = 0; y < rows; ++y)
-                            {
-                                for (ssize_t x = 0; x < cols; ++x)
-                                {
-                                    erase(x, y);
-                                }
-                            }
+                            KAM = setting;
                             break;
                         case 4:
-                            TRACE("%cM DECSCLM",
-                                ch == 'h'? 'S' : 'R');
-                            DECSCLM = setting;
-                            break;
-                        case 5:
-                            TRACE("%cM DECSCNM",
-                                ch == 'h'? 'S' : 'R');
-                            DECSCNM = setting;
-                            break;
-                        case 6:
-                            TRACE("%cM DECOM",
-                                ch == 'h'? 'S' : 'R');
-                            DECOM = setting;
-                            /* the cursor moves to the new home
-                             * position when DECOM is changed */
-                            move_curs(0, DECOM? scroll_top : 0);
-                            break;
-                        case 7:
-                            TRACE("%cM DECAWM", ch == 'h'? 'S' : 'R');
-                            DECAWM = setting;
-                            break;
-                        case 8:
-                            TRACE("%cM DECARM", ch == 'h'? 'S' : 'R');
-                            DECARM = setting;
+                            IRM = setting;
                             break;
-                        case 18:
-                            TRACE("%cM DECPFF", ch == 'h'? 'S' : 'R');
-                            DECPFF = setting;
+                        case 12:
+                            SRM = setting;
                             break;
-                        case 19:
-                            TRACE("%cM DECPEX", ch == 'h'? 'S' : 'R');
-                            DECPEX = setting;
+                        case 20:
+                            LNM = setting;
                             break;
 
                         default:
-                            throw std::runtime_error(
-                                std::string(setting? "S" : "R")
-                                + "M - undefined DEC Private "
-                                + "Mode sequence"
-                                + cmd->params[1]);
+                            status = error(
+                                Error::UnknownParameter,
+                                name,
+                                ch);
                             break;
                         }
+                        continue;
+                    }
+
+                    switch (mode)
+                    {
+                    case 1:
+                        /* when the keypad is in Numeric mode,
+                         * DECCKM is always reset */
+                        if (keypad_mode == KPMode::Numeric)
+                        {
+                            DECCKM = false;
+                        }
+                        else
+                        {
+                            DECCKM = setting;
+                        }
+                        break;
+                    case 2:
+                        if (!setting)
+                        {
+                            /* VT52 compatibility mode */
+                            DECANM = true;
+                            status = error(
+                                Error::Unimplemented,
+                                "VT52 mode",
+                                ch);
+                        }
+                        break;
+                    case 3:
+                        DECCOLM = setting;
+                        if (cols < (setting? 132 : 80))
+                        {
+                            resize(setting? 132 : 80, rows);
+                        }
+                        /* when the columns per line is changed,
+                         * the screen is erased */
+                        for (ssize_t y = 0; y < rows; ++y)
+                        {
+                            erase(0, cols, y);
+                        }
+                        break;
+                    case 4:
+                        DECSCLM = setting;
+                        break;
+                    case 5:
+                        DECSCNM = setting;
+                        break;
+                    case 6:
+                        DECOM = setting;
+                        /* the cursor moves to the new home
+                         * position when DECOM is changed */
+                        move_curs(0, DECOM? scroll_top : 0);
+                        break;
+                    case 7:
+                        DECAWM = setting;
+                        break;
+                    case 8:
+                        DECARM = setting;
+                        break;
+                    case 18:
+                        DECPFF = setting;
+                        break;
+                    case 19:
+                        DECPEX = setting;
+                        break;
+
+                    default:
+                        status = error(Error::UnknownParameter, name, ch);
+                        break;
                     }
-                }
-                else
-                {
-                    throw std::runtime_error(
-                        std::string(setting? "S" : "R")
-                        + std::string("M takes 1 or 2 parameters"));
                 }
               } break;
 
             /* MC */
             case 'i':
                 /* ignored by this emulator */
-                TRACE("MC");
+                TRACE(TraceOp::MC);
                 break;
 
             /* SGR */
             case 'm':
                 if (cmd->params.size() == 0)
                 {
-                    TRACE("SGR off");
+                    TRACE(TraceOp::SGR, 0);
+                    parse_stats().sgr[0].add(1);
                     char_attributes = 0;
                 }
                 else
                 {
-                    std::string debug_string = "SGR";
-                    for (std::string param : cmd->params)
+                    /* attributes which aren't recognised are
+                     * ignored, the rest still apply */
+                    for (size_t i = 0; i < cmd->params.size(); ++i)
                     {
-                        int attr = (param == "")
-                            ? 0
-                            : std::stoi(param);
+                        int attr = 0;
+                        if (!get_param(cmd, i, 0, &attr))
+                        {
+                            status = error(Error::BadParameters, "SGR", ch);
+                            continue;
+                        }
+                        TRACE(TraceOp::SGR, attr);
+                        ParseStats &stats = parse_stats();
                         switch (attr)
                         {
                         case 0:
-                            debug_string += " off";
+                            stats.sgr[0].add(1);
                             char_attributes = 0;
                             break;
                         case 1:
-                            debug_string += " bold";
+                            stats.sgr[1].add(1);
                             char_attributes |= BOLD;
                             break;
                         case 4:
-                            debug_string += " underline";
+                            stats.sgr[2].add(1);
                             char_attributes |= UNDERLINE;
                             break;
                         case 5:
-                            debug_string += " blink";
+                            stats.sgr[3].add(1);
                             char_attributes |= BLINK;
                             break;
                         case 7:
-                            debug_string += " reverse";
+                            stats.sgr[4].add(1);
                             char_attributes |= REVERSE;
                             break;
 
                         default:
-                            throw std::runtime_error(
-                                std::string(
-                                    "SGR - undefined DEC Private "
-                                    "Mode sequence")
-                                + cmd->params[1]);
+                            stats.sgr[5].add(1);
+                            status = error(
+                                Error::UnknownParameter,
+                                "SGR",
+                                ch);
                             break;
                         }
                     }
-                    TRACE("%s", debug_string.c_str());
                 }
                 break;
 
             /* DSR */
             case 'n':
-                if (cmd->params.size() != 1)
-                {
-                    throw std::runtime_error("DSR takes 1 parameter");
-                }
-                else
+                if (cmd->params.size() == 2 && cmd->params[0] == "?")
                 {
-                    if (cmd->params.size() == 2)
+                    int code = 0;
+                    if (!get_param(cmd, 1, 0, &code))
                     {
-                        if (cmd->params[0] == "?")
-                        {
-                            int code = std::stoi(cmd->params[1]);
-                            if (code == 15)
-                            {
-                                /*  `ESC [ ? 13 n` - no printer
-                                 *                   connected
-                                 *  `ESC [ ? 11 n` - printer not ready
-                                 *  `ESC [ ? 10 n` - printer ready */
-                                TRACE("DSR printer status");
-                                output("\033[?13n");
-                            }
-                        }
-                        else
-                        {
-                            throw std::runtime_error(
-                                std::string(
-                                    "undefined DEC Private Mode "
-                                    "sequence `ESC [ ")
-                                + cmd->params[0]
-                                + ";"
-                                + cmd->params[1]
-                                + "n`");
-                        }
+                        status = error(Error::BadParameters, "DSR", ch);
                     }
-                    else if (cmd->params.size() == 1)
+                    else if (code == 15)
                     {
-                        int code = std::stoi(cmd->params[0]);
-                        switch (code)
-                        {
-                        /* status report */
-                        case 5:
-                            /* `ESC [ 0 n` - ready, no errors
-                             * `ESC [ 3 n` - error */
-                            TRACE("DSR status");
-                            output("\033[0n");
-                            break;
-                        case 6:
-                            /* `ESC [ curs_y ; curs_x R` */
-                            TRACE("DSR cursor position");
-                            output(
-                                "\033["
-                                + std::to_string(
-                                    scroll_top + curs_y + 1)
-                                + ";"
-                                + std::to_string(curs_x + 1)
-                                + "R");
-                            break;
-                        }
+                        /*  `ESC [ ? 13 n` - no printer connected
+                         *  `ESC [ ? 11 n` - printer not ready
+                         *  `ESC [ ? 10 n` - printer ready */
+                        TRACE(TraceOp::DSR, code);
+                        output("\033[?13n");
                     }
                     else
                     {
-                        throw std::runtime_error(
-                            "DSR takes 1 or 2 arguments");
+                        status = error(Error::UnknownParameter, "DSR", ch);
+                    }
+                }
+                else if (cmd->params.size() == 1)
+                {
+                    int code = 0;
+                    if (!get_param(cmd, 0, 0, &code))
+                    {
+                        status = error(Error::BadParameters, "DSR", ch);
+                        break;
+                    }
+                    switch (code)
+                    {
+                    /* status report */
+                    case 5:
+                        /* `ESC [ 0 n` - ready, no errors
+                         * `ESC [ 3 n` - error */
+                        TRACE(TraceOp::DSR, code);
+                        output("\033[0n");
+                        break;
+                    case 6:
+                      {
+                        /* `ESC [ curs_y ; curs_x R` */
+                        TRACE(TraceOp::DSR, code);
+                        char report[32];
+                        int const n = snprintf(
+                            report,
+                            sizeof(report),
+                            "\033[%zd;%zdR",
+                            (ssize_t)(scroll_top + curs_y + 1),
+                            (ssize_t)(curs_x + 1));
+                        output(std::string_view(report, n));
+                      } break;
+
+                    default:
+                        status = error(Error::UnknownParameter, "DSR", ch);
+                        break;
                     }
                 }
+                else
+                {
+                    status = error(Error::BadParameters, "DSR", ch);
+                }
                 break;
 
             /* DECLL */
@@ -1866,48 +2014,40 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
                     /* LED on */
                     if (cmd->params[0] == "0")
                     {
-                        TRACE("DECLL on");
+                        TRACE(TraceOp::DECLL, 0);
                     }
                     /* LED off */
                     else if (cmd->params[0] == "1")
                     {
-                        TRACE("DECLL off");
+                        TRACE(TraceOp::DECLL, 1);
                     }
                     else
                     {
-                        throw std::runtime_error(
-                            "invalid argument to DECLL");
+                        status = error(
+                            Error::UnknownParameter,
+                            "DECLL",
+                            ch);
                     }
                 }
                 else
                 {
-                    throw std::runtime_error(
-                        "DECLL takes 1 argument");
+                    status = error(Error::BadParameters, "DECLL", ch);
                 }
                 break;
 
             /* DECSTBM */
             case 'r':
               {
-                int top = 0,
-                    bottom = rows-1;
-                switch (cmd->params.size())
+                /* 0 is the same as leaving the margin out */
+                int args[2] = { 0, 0 };
+                if (!get_params(cmd, 2, 0, args))
                 {
-                case 0:
-                    break;
-                case 2:
-                    bottom = std::stoi(cmd->params[1])-1;
-                    /* intentional fallthrough! */
-                case 1:
-                    top = std::stoi(cmd->params[0])-1;
-                    break;
-
-                default:
-                    throw std::runtime_error(
-                        "DECSTBM takes up to 2 arguments");
+                    status = error(Error::BadParameters, "DECSTBM", ch);
                     break;
                 }
-                TRACE("DECSTBM %d %d", top, bottom);
+                int top = (args[0] == 0)? 0 : args[0] - 1,
+                    bottom = (args[1] == 0)? rows - 1 : args[1] - 1;
+                TRACE(TraceOp::DECSTBM, top, bottom);
                 /* minimum size of the scrolling region is 2 lines */
                 if (top < bottom && top >= 0 && bottom < rows)
                 {
@@ -1921,41 +2061,25 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
 
             /* DECTST */
             case 'y':
-                TRACE("DECTST");
-                throw std::runtime_error("DECTST not implemented");
+                TRACE(TraceOp::DECTST);
+                status = error(Error::Unimplemented, "DECTST", ch);
                 break;
 
 
             default:
-              {
-                std::string errmsg =\
-                    "undefined control sequence ESC [";
-                for (std::string param : cmd->params)
-                {
-                    for (char byte : param)
-                    {
-                        errmsg += " " + std::to_string(byte);
-                    }
-                    errmsg += " ;";
-                }
-                for (char byte : cmd->intermediate)
-                {
-                    errmsg += " " + std::to_string(byte);
-                }
-                errmsg += " " + std::to_string(cmd->final);
-                throw std::runtime_error(errmsg);
-              } break;
+                status = error(
+                    Error::UnknownControlSequence,
+                    "CSI",
+                    ch);
+                break;
             }
         }
         else
         {
-            std::string errmsg = "undefined control sequence ESC [";
-            for (char byte : cmd->intermediate)
-            {
-                errmsg += " " + std::to_string(byte);
-            }
-            errmsg += " " + std::to_string(cmd->final);
-            throw std::runtime_error(errmsg);
+            status = error(
+                Error::UnknownControlSequence,
+                "CSI",
+                ch);
         }
         delete cmd;
         cmd = nullptr;
@@ -1963,13 +2087,15 @@ void VT102::interpret_byte_ctrlseq(uint8_t ch)
 
 
     default:
-        interpret_byte_control_character(ch);
+        status = interpret_byte_control_character(ch);
         break;
     }
+    return status;
 }
 
 void VT102::enter_setup(void)
 {
+    /* the rows are shared, not copied */
     saved_screen = screen;
     saved_state = state;
 
@@ -1980,441 +2106,305 @@ void VT102::enter_setup(void)
 
 void VT102::display_setup(void)
 {
-    /* clear the screen */
-    for (ssize_t y = 0; y < rows; ++y)
+    /* clear the screen, only the rows SET-UP writes to get copies
+     * of their own */
+    std::fill(screen.begin(), screen.end(), blank_row());
+
+    char const *title = (state == State::SetUpA? "SET-UP A" : "SET-UP B");
+    edit_line(0).attr = Line::DOUBLE_HEIGHT_UPPER;
+    setup_text(0, 0, title, BOLD);
+    edit_line(1).attr = Line::DOUBLE_HEIGHT_LOWER;
+    setup_text(0, 1, title, BOLD);
+    edit_line(2).attr = Line::DOUBLE_WIDTH;
+    setup_text(0, 2, "TO EXIT PRESS \"SET-UP\"", UNDERLINE);
+
+    if (state == State::SetUpA)
     {
-        for (ssize_t x = 0; x < cols; ++x)
+        /* column ruler, every other ten columns are reversed */
+        for (ssize_t x = 0; x < cols; x += 10)
         {
-            erase(x, y);
+            setup_text(x, rows - 1, "1234567890", (x / 10) % 2? REVERSE : 0);
         }
-        screen[curs_y].attr = Line::NORMAL;
-    }
-
-    curs_x = 0;
-    curs_y = 0;
-
-    screen[curs_y].attr = Line::DOUBLE_HEIGHT_UPPER;
-    char_attributes = BOLD;
-    for (char ch : state == State::SetUpA? "SET-UP A" : "SET-UP B")
-    {
-        putc(ch);
     }
-    curs_x = 0;
-    screen[++curs_y].attr = Line::DOUBLE_HEIGHT_LOWER;
-    for (char ch : state == State::SetUpA? "SET-UP A" : "SET-UP B")
+    else
     {
-        putc(ch);
+        setup_text(1, rows - 6, "V1.1", 0);
+        setup_text(16, rows - 6, "MODEM", BOLD | UNDERLINE);
+        setup_text(51, rows - 6, "PRINTER", BOLD | UNDERLINE);
     }
 
-    curs_x = 0;
-    screen[++curs_y].attr = Line::DOUBLE_WIDTH;
-    char_attributes = UNDERLINE;
-    for (char ch : "TO EXIT PRESS \"SET-UP\"")
+    display_setup_page();
+    if (state == State::CreateAnswerback)
     {
-        if (ch != 0)
-        {
-            putc(ch);
-        }
+        display_setup_answerback();
     }
-    char_attributes = 0;
+}
 
+void VT102::display_setup_page(void)
+{
     if (state == State::SetUpA)
     {
-        curs_y = rows - 1;
-        curs_x = 0;
-        bool inverted = false;
-        for (ssize_t x = 0; x < cols; ++x)
-        {
-            inverted = ((x / 10) % 2 == 1);
-            char ch = '0' + ((x + 1) % 10);
-            putc(ch);
-            screen[rows - 1][x].reverse = inverted;
-        }
-
-        curs_y = rows - 2;
-        curs_x = 0;
-        for (ssize_t x = 0; x < cols; ++x)
-        {
-            if  (setup.tab_stops[x])
-            {
-                putc('T');
-            }
-            else
-            {
-                putc(' ');
-            }
-        }
+        display_setup_tab_stops();
     }
     else
     {
-        unsigned tmp = char_attributes;
-
-        curs_y = rows - 6;
-        curs_x = 1;
-
-        for (char ch : "V1.1")
-        {
-            putc(ch);
-        }
-        for (size_t i = 0; i < 10; ++i)
-        {
-            putc(' ');
-        }
-        char_attributes = BOLD | UNDERLINE;
-        putc('M');
-        putc('O');
-        putc('D');
-        putc('E');
-        putc('M');
-        char_attributes = 0;
-        for (size_t i = 0; i < 30; ++i)
-        {
-            putc(' ');
-        }
-        char_attributes = BOLD | UNDERLINE;
-        putc('P');
-        putc('R');
-        putc('I');
-        putc('N');
-        putc('T');
-        putc('E');
-        putc('R');
-        char_attributes = 0;
-
-
-        curs_y = rows - 4;
-        curs_x = 2;
-
-        char_attributes = modem_features_selected? REVERSE : 0;
-
-        /* modem data/parity bits */
-        std::string const parities[8] =\
-        {
-            "7M",
-            "7S",
-            "7O",
-            "7E",
-            "7N",
-            "8O",
-            "8E",
-            "8N",
-        };
-        putc('P');
-        putc('=');
-        putc(parities[setup.modem.data_parity_bits][0]);
-        putc(parities[setup.modem.data_parity_bits][1]);
-
-        putc(' ');
-        putc(' ');
-
-        /* modem tx speed */
-        std::string const tx_rx_speeds[16] =\
-        {
-            "   50",  "   75",  "  110", "134.5",
-            "  150",  "  200",  "  300", "  600",
-            " 1200",  " 1800",  " 2000", " 2400",
-            " 3600",  " 4800",  " 9600", "19200",
-        };
-        putc('T');
-        putc('=');
-        putc(tx_rx_speeds[setup.modem.tx_speed][0]);
-        putc(tx_rx_speeds[setup.modem.tx_speed][1]);
-        putc(tx_rx_speeds[setup.modem.tx_speed][2]);
-        putc(tx_rx_speeds[setup.modem.tx_speed][3]);
-        putc(tx_rx_speeds[setup.modem.tx_speed][4]);
-
-        putc(' ');
-        putc(' ');
-
-        /* modem rx speed */
-        putc('R');
-        putc('=');
-        putc(tx_rx_speeds[setup.modem.rx_speed][0]);
-        putc(tx_rx_speeds[setup.modem.rx_speed][1]);
-        putc(tx_rx_speeds[setup.modem.rx_speed][2]);
-        putc(tx_rx_speeds[setup.modem.rx_speed][3]);
-        putc(tx_rx_speeds[setup.modem.rx_speed][4]);
-
-        putc(' ');
-        putc(' ');
-
-        /* modem_control */
-        std::string const control[5] =\
-        {
-            "FDX A",
-            "FDX B",
-            "FDX C",
-            "HDX A",
-            "HDX B",
-        };
-        putc(control[setup.modem.control][0]);
-        putc(control[setup.modem.control][1]);
-        putc(control[setup.modem.control][2]);
-        putc(control[setup.modem.control][3]);
-        putc(control[setup.modem.control][4]);
-
-        putc(' ');
-        putc(' ');
-
-        /* turnaround/disconnect character */
-        std::string const turnaround[6][2] =\
-        {
-            { "   ", "   " },
-            { "FF ", "EOT" },
-            { "ETX", "EOT" },
-            { "EOT", "DLE" },
-            { "CR ", "EOT" },
-            { "DC3", "EOT" },
-        };
-        std::string const *characters =\
-            turnaround[setup.modem.turnaround_disconn_char];
-        putc(characters[setup.modem.control != 4][0]);
-        putc(characters[setup.modem.control != 4][1]);
-        putc(characters[setup.modem.control != 4][2]);
-
-
-        char_attributes = 0;
-        for (size_t i = 0; i < 11; ++i)
-        {
-            putc(' ');
-        }
-
-
-        char_attributes = modem_features_selected? 0 : REVERSE;
-
-        /* printer data/parity bits */
-        putc('P');
-        putc('=');
-        putc(parities[setup.printer.data_parity_bits][0]);
-        putc(parities[setup.printer.data_parity_bits][1]);
-
-        putc(' ');
-        putc(' ');
-
-        /* printer tx/rx speed */
-        putc('T');
-        putc('/');
-        putc('R');
-        putc('=');
-        putc(tx_rx_speeds[setup.printer.tx_rx_speed][0]);
-        putc(tx_rx_speeds[setup.printer.tx_rx_speed][1]);
-        putc(tx_rx_speeds[setup.printer.tx_rx_speed][2]);
-        putc(tx_rx_speeds[setup.printer.tx_rx_speed][3]);
-        putc(tx_rx_speeds[setup.printer.tx_rx_speed][4]);
-
-
-        curs_y = rows - 1;
-        curs_x = 0;
-
-        char_attributes = 0;
-        putc('1');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(DECSCLM? '1' : '0');
-        putc(DECARM? '1' : '0');
-        putc(DECSCNM? '1' : '0');
-        putc(setup.block_cursor? '1' : '0');
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('2');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(setup.margin_bell? '1' : '0');
-        putc(setup.keyclick? '1' : '0');
-        putc(DECANM? '1' : '0');
-        putc(setup.auto_XON_XOFF? '1' : '0');
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('3');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(setup.UK_charset? '1' : '0');
-        putc(DECAWM? '1' : '0');
-        putc(LNM? '1' : '0');
-        putc(SRM? '1' : '0');
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('4');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(DECPFF? '1' : '0');
-        putc(DECPEX? '1' : '0');
-        putc(setup.stop_bits? '1' : '0');
-        putc(setup.receive_parity? '1' : '0');
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('5');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(setup.break_enable? '1' : '0');
-        putc(setup.disconn_char_enable? '1' : '0');
-        putc(setup.disconn_delay? '1' : '0');
-        putc(setup.auto_answerback? '1' : '0');
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('6');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(setup.initial_direction? '1' : '0');
-        putc(setup.auto_turnaround? '1' : '0');
-        putc('0');  /* always 0 */
-        putc('0');  /* always 0 */
-
-        char_attributes = 0;
-        putc(' ');
-        putc(' ');
-
-        putc('7');
-        putc(' ');
-        char_attributes |= REVERSE;
-        putc(setup.power? '1' : '0');
-        putc(setup.wps_terminal_kbd? '1' : '0');
-        putc('1');  /* always 1 */
-        putc('0');  /* always 0 */
-
-        char_attributes = tmp;
+        display_setup_modem();
+        display_setup_printer();
+        display_setup_switches();
     }
-    if (state == State::CreateAnswerback)
-    {
-        unsigned int tmp = char_attributes;
+}
 
-        curs_y = rows - 2;
-        curs_x = 0;
-        char_attributes = BOLD;
-        putc('A');
-        putc('=');
-        char_attributes = 0;
-        putc(' ');
-        putc(setup.delimiter);
-        for (char ch : answerback)
+void VT102::display_setup_tab_stops(void)
+{
+    std::string stops(cols, ' ');
+    for (ssize_t x = 0; x < cols; ++x)
+    {
+        if (setup.tab_stops[x])
         {
-            putc(ch);
+            stops[x] = 'T';
         }
-        char_attributes = REVERSE;
-        putc(setup.delimiter);
-        char_attributes = tmp;
     }
+    setup_text(0, rows - 2, stops, 0);
 }
 
-void VT102::exit_setup(void)
+void VT102::display_setup_tab_stop(ssize_t x)
 {
-    state = saved_state;
-    screen = saved_screen;
-    curs_x = 0;
-    curs_y = 0;
+    setup_text(x, rows - 2, setup.tab_stops[x]? "T" : " ", 0);
 }
 
-char VT102::getkey(Key key, unsigned int mod) const
-{
-    std::unordered_map<Key, std::array<int, 3>> const keymap =\
-    {
-        /* key
-         *                 unshifted
-         *                 |    shifted
-         *                 |    |    ctrl
-         *                 |    |    |
-         *                 v    v    v */
-        { Escape,       { 033, 033,  -1 } },
-
-        { KB_1,         { '1', '!',  -1 } },
-        { KB_2,         { '2', '@',  -1 } },
-        { KB_3,         { '3', '#',  -1 } },
-        { KB_4,         { '4', '$',  -1 } },
-        { KB_5,         { '5', '%',  -1 } },
-        { KB_6,         { '6', '^',  -1 } },
-        { KB_7,         { '7', '&',  -1 } },
-        { KB_8,         { '8', '*',  -1 } },
-        { KB_9,         { '9', '(',  -1 } },
-        { KB_0,         { '0', ')',  -1 } },
-        { Minus,        { '-', '_',  -1 } },
-        { Equals,       { '=', '+',  -1 } },
-        { Backtick,     { '`', '~', 036 } },
-        { Backspace,    {'\b','\b',  -1 } },
-
-        { Tab,          {'\t','\t',  -1 } },
-        { KB_Q,         { 'q', 'Q', 021 } },
-        { KB_W,         { 'w', 'W', 027 } },
-        { KB_E,         { 'e', 'E', 005 } },
-        { KB_R,         { 'r', 'R', 022 } },
-        { KB_T,         { 't', 'T', 024 } },
-        { KB_Y,         { 'y', 'Y', 031 } },
-        { KB_U,         { 'u', 'U', 025 } },
-        { KB_I,         { 'i', 'I', 011 } },
-        { KB_O,         { 'o', 'O', 017 } },
-        { KB_P,         { 'p', 'P', 020 } },
-        { LeftBracket,  { '[', '{', 033 } },
-        { RightBracket, { ']', '}', 035 } },
-        { Delete,       {0177,0177,  -1 } },
-
-        { KB_A,         { 'a', 'A', 001 } },
-        { KB_S,         { 's', 'S', 023 } },
-        { KB_D,         { 'd', 'D', 004 } },
-        { KB_F,         { 'f', 'F', 006 } },
-        { KB_G,         { 'g', 'G', 007 } },
-        { KB_H,         { 'h', 'H', 010 } },
-        { KB_J,         { 'j', 'J', 012 } },
-        { KB_K,         { 'k', 'K', 013 } },
-        { KB_L,         { 'l', 'L', 014 } },
-        { Semicolon,    { ';', ':',  -1 } },
-        { Quote,        { '\'','"',  -1 } },
-        { Backslash,    { '\\','|', 034 } },
-
-        { KB_Z,         { 'z', 'Z', 032 } },
-        { KB_X,         { 'x', 'X', 030 } },
-        { KB_C,         { 'c', 'C', 003 } },
-        { KB_V,         { 'v', 'V', 026 } },
-        { KB_B,         { 'b', 'B', 002 } },
-        { KB_N,         { 'n', 'N', 016 } },
-        { KB_M,         { 'm', 'M', 015 } },
-        { Comma,        { ',', '<',  -1 } },
-        { Period,       { '.', '>',  -1 } },
-        { Slash,        { '/', '?', 037 } },
-        { LineFeed,     {'\n','\n',  -1 } },
-
-        { Space,        { ' ', ' ', 000 } },
-    };
-
-    int idx = 0;
-    char ch = 0;
+static char const *const setup_parities[8] =\
+{
+    "7M",
+    "7S",
+    "7O",
+    "7E",
+    "7N",
+    "8O",
+    "8E",
+    "8N",
+};
+
+static char const *const setup_speeds[16] =\
+{
+    "   50",  "   75",  "  110", "134.5",
+    "  150",  "  200",  "  300", "  600",
+    " 1200",  " 1800",  " 2000", " 2400",
+    " 3600",  " 4800",  " 9600", "19200",
+};
 
-    if (mod & (Shift | CapsLock))
+void VT102::display_setup_modem(void)
+{
+    /* modem control */
+    char const *const control[5] =\
     {
-        idx = 1;
-    }
-    /* IMPORTANT: CTRL overrides SHIFT! */
-    if (mod & Ctrl)
+        "FDX A",
+        "FDX B",
+        "FDX C",
+        "HDX A",
+        "HDX B",
+    };
+    /* turnaround/disconnect character */
+    char const *const turnaround[6][2] =\
     {
-        idx = 2;
+        { "   ", "   " },
+        { "FF ", "EOT" },
+        { "ETX", "EOT" },
+        { "EOT", "DLE" },
+        { "CR ", "EOT" },
+        { "DC3", "EOT" },
+    };
+
+    std::string text;
+    text += "P=";
+    text += setup_parities[setup.modem.data_parity_bits];
+    text += "  T=";
+    text += setup_speeds[setup.modem.tx_speed];
+    text += "  R=";
+    text += setup_speeds[setup.modem.rx_speed];
+    text += "  ";
+    text += control[setup.modem.control];
+    text += "  ";
+    text += turnaround[setup.modem.turnaround_disconn_char]
+                      [setup.modem.control != 4];
+    setup_text(2, rows - 4, text, modem_features_selected? REVERSE : 0);
+}
+
+void VT102::display_setup_printer(void)
+{
+    std::string text;
+    text += "P=";
+    text += setup_parities[setup.printer.data_parity_bits];
+    text += "  T/R=";
+    text += setup_speeds[setup.printer.tx_rx_speed];
+    setup_text(47, rows - 4, text, modem_features_selected? 0 : REVERSE);
+}
+
+void VT102::display_setup_switches(void)
+{
+    /* seven groups of four switches, "1 xxxx  2 xxxx  ..." */
+    for (int group = 0; group < 7; ++group)
+    {
+        setup_text(group * 8, rows - 1, std::string(1, '1' + group), 0);
+        for (ssize_t x = group * 8 + 2; x < group * 8 + 6; ++x)
+        {
+            display_setup_switch(x);
+        }
+    }
+}
+
+void VT102::display_setup_switch(ssize_t x)
+{
+    bool const *feature = setup_switch(x);
+    /* the switches which don't do anything are always 0, apart from
+     * the 3rd switch of group 7 */
+    bool const on = (feature? *feature : x == 52);
+    setup_text(x, rows - 1, on? "1" : "0", REVERSE);
+}
+
+bool *VT102::setup_switch(ssize_t x)
+{
+    switch (x)
+    {
+    /* 1 */
+    case 2:
+        return &DECSCLM;
+    case 3:
+        return &DECARM;
+    case 4:
+        return &DECSCNM;
+    case 5:
+        return &setup.block_cursor;
+
+    /* 2 */
+    case 10:
+        return &setup.margin_bell;
+    case 11:
+        return &setup.keyclick;
+    case 12:
+        return &DECANM;
+    case 13:
+        return &setup.auto_XON_XOFF;
+
+    /* 3 */
+    case 18:
+        return &setup.UK_charset;
+    case 19:
+        return &DECAWM;
+    case 20:
+        return &LNM;
+    case 21:
+        return &SRM;
+
+    /* 4 */
+    case 26:
+        return &DECPFF;
+    case 27:
+        return &DECPEX;
+    case 28:
+        return &setup.stop_bits;
+    case 29:
+        return &setup.receive_parity;
+
+    /* 5 */
+    case 34:
+        return &setup.break_enable;
+    case 35:
+        return &setup.disconn_char_enable;
+    case 36:
+        return &setup.disconn_delay;
+    case 37:
+        return &setup.auto_answerback;
+
+    /* 6 */
+    case 42:
+        return &setup.initial_direction;
+    case 43:
+        return &setup.auto_turnaround;
+
+    /* 7 */
+    case 50:
+        return &setup.power;
+    case 51:
+        return &setup.wps_terminal_kbd;
+
+    default:
+        return nullptr;
     }
+}
+
+void VT102::display_setup_answerback(void)
+{
+    ssize_t const y = rows - 2;
+    std::string const delimiter(1, setup.delimiter);
 
-    try
+    setup_text(0, y, "A=", BOLD);
+    setup_text(2, y, " " + delimiter, 0);
+    for (int i = 0; i < 20; ++i)
     {
-        ch = keymap.at(key)[idx];
+        /* control characters are shown as a diamond */
+        if (i < setup.answerback_idx && (uint8_t)answerback[i] < 0x20)
+        {
+            setup_text(4 + i, y, "\x60", 0, CharSet::Special);
+        }
+        else
+        {
+            setup_text(4 + i, y, std::string(1, answerback[i]), 0);
+        }
     }
-    catch (std::out_of_range &e)
+    setup_text(24, y, delimiter, REVERSE);
+}
+
+void VT102::setup_text(
+    ssize_t x,
+    ssize_t y,
+    std::string const &text,
+    unsigned attributes,
+    CharSet charset)
+{
+    if (y < 0 || y >= rows)
     {
-        throw std::invalid_argument(
-            "bad key '"
-            + std::to_string(key)
-            + "'");
+        return;
     }
 
-    return ch;
+    /* written straight into the cells, so none of the modes which
+     * affect putc (IRM, DECAWM, ...) apply */
+    Line &line = edit_line(y);
+    for (size_t i = 0; i < text.size() && x + (ssize_t)i < cols; ++i)
+    {
+        Char &chr = line[x + i];
+        chr.ch = text[i];
+        chr.charset = charset;
+        chr.glyph = fontidx(charset, chr.ch);
+        chr.bold = attributes & BOLD;
+        chr.underline = attributes & UNDERLINE;
+        chr.blink = attributes & BLINK;
+        chr.reverse = attributes & REVERSE;
+    }
+}
+
+void VT102::exit_setup(void)
+{
+    state = saved_state;
+    /* hand the rows back, so they aren't shared any more */
+    screen = std::move(saved_screen);
+    saved_screen.clear();
+    curs_x = 0;
+    curs_y = 0;
+}
+
+int VT102::getkey(Key key, unsigned int mod) const
+{
+    int idx = 0;
+    if (mod & (Shift | CapsLock))
+    {
+        idx = 1;
+    }
+    /* IMPORTANT: CTRL overrides SHIFT! */
+    if (mod & Ctrl)
+    {
+        idx = 2;
+    }
+    return ((size_t)key < keys)? key_chars[key][idx] : -1;
 }
 
 void VT102::resize(ssize_t i_cols, ssize_t i_rows)
@@ -2422,68 +2412,495 @@ void VT102::resize(ssize_t i_cols, ssize_t i_rows)
     cols = i_cols;
     rows = i_rows;
 
-    std::vector<bool> newstops;
+    /* the scrolling region is reset to the whole screen */
+    scroll_top = 0;
+    scroll_bottom = rows - 1;
+
+    /* keep the tab stops which are still on the screen, new columns
+     * get the default stops */
+    size_t const old_cols = setup.tab_stops.size();
+    setup.tab_stops.resize(cols);
+    for (size_t i = old_cols; i < (size_t)cols; ++i)
+    {
+        setup.tab_stops[i] = (i != 0 && i % 8 == 0);
+    }
+
+    /* the cursor has to stay on the screen */
+    curs_x = std::min<ssize_t>(curs_x, cols - 1);
+    curs_y = std::min<ssize_t>(curs_y, rows - 1);
+
+    resize_rows(&screen);
+    /* SET-UP's saved screen only exists while it's open */
+    if (!saved_screen.empty())
+    {
+        resize_rows(&saved_screen);
+        display_setup();
+    }
+}
+
+void VT102::resize_rows(std::vector<Row> *lines) const
+{
+    Row const blank = blank_row();
+    lines->resize(rows, blank);
+    for (Row &row : *lines)
+    {
+        /* rows which are already the right width are kept as they
+         * are, shared or not */
+        if (row != blank && (ssize_t)row->chars.size() != cols)
+        {
+            std::shared_ptr<Line> line = std::make_shared<Line>(*row);
+            line->chars.resize(cols, blank->chars[0]);
+            row = line;
+        }
+    }
+}
+
+
+size_t VT102::memory_usage(void) const
+{
+    size_t size = sizeof(*this);
+
+    for (std::vector<Row> const *lines : { &screen, &saved_screen })
+    {
+        size += lines->capacity() * sizeof(Row);
+        /* shared rows are split between their owners */
+        for (Row const &row : *lines)
+        {
+            size +=   (sizeof(Line) + row->chars.capacity() * sizeof(Char))
+                    / row.use_count();
+        }
+    }
+    size += scrollback.memory_usage() - sizeof(scrollback);
+    size += (setup.tab_stops.capacity() + user_setup.tab_stops.capacity())
+          / 8;
+    size += outbuffer.capacity();
+    size += blanks.capacity() * sizeof(Char);
+    if (cmd != nullptr)
+    {
+        size += sizeof(*cmd) + cmd->intermediate.capacity();
+        for (std::string const &param : cmd->params)
+        {
+            size += sizeof(param) + param.capacity();
+        }
+    }
+    if (saved != nullptr)
+    {
+        size += sizeof(*saved);
+    }
+    return size;
+}
+
+
+/* snapshot encoding: fixed-width fields in host byte order */
+template<typename T>
+static void put(std::string *out, T value)
+{
+    out->append((char const *)&value, sizeof(value));
+}
+
+static void put_string(std::string *out, std::string const &str)
+{
+    put<uint32_t>(out, str.size());
+    out->append(str);
+}
+
+static void put_setup(std::string *out, VT102::Setup const &setup)
+{
+    for (bool flag :
+        {
+            setup.online, setup.block_cursor, setup.margin_bell,
+            setup.keyclick, setup.auto_XON_XOFF, setup.UK_charset,
+            setup.stop_bits, setup.receive_parity, setup.break_enable,
+            setup.disconn_char_enable, setup.disconn_delay,
+            setup.auto_answerback, setup.initial_direction,
+            setup.auto_turnaround, setup.power, setup.wps_terminal_kbd
+        })
+    {
+        put<uint8_t>(out, flag);
+    }
+    put<int32_t>(out, setup.delimiter);
+    put<int32_t>(out, setup.answerback_idx);
+    put<double>(out, setup.brightness);
+    put<uint32_t>(out, setup.tab_stops.size());
     for (bool stop : setup.tab_stops)
     {
-        newstops.push_back(stop);
+        put<uint8_t>(out, stop);
     }
-    for (size_t i = 0; i < cols - setup.tab_stops.size(); ++i)
+    for (int value :
+        {
+            setup.modem.data_parity_bits, setup.modem.tx_speed,
+            setup.modem.rx_speed, setup.modem.control,
+            setup.modem.turnaround_disconn_char,
+            setup.printer.data_parity_bits, setup.printer.tx_rx_speed
+        })
     {
-        if (i < setup.tab_stops.size())
+        put<int32_t>(out, value);
+    }
+}
+
+static void put_lines(std::string *out, std::vector<Row> const &lines)
+{
+    put<uint32_t>(out, lines.size());
+    for (Row const &row : lines)
+    {
+        put<uint8_t>(out, row->attr);
+        put<uint32_t>(out, row->chars.size());
+        out->append(
+            (char const *)row->chars.data(),
+            row->chars.size() * sizeof(Char));
+    }
+}
+
+/* reads a snapshot, throwing if it runs out */
+struct SnapshotReader
+{
+    uint8_t const *data;
+    size_t size,
+           pos;
+
+    template<typename T>
+    T get(void)
+    {
+        T value;
+        if (size - pos < sizeof(value))
         {
-            newstops.push_back(setup.tab_stops[i]);
+            throw std::runtime_error("snapshot truncated");
         }
-        else
+        memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+
+    std::string get_string(void)
+    {
+        uint32_t const length = get<uint32_t>();
+        if (size - pos < length)
         {
-            newstops.push_back(i != 0 && i % 8 == 0);
+            throw std::runtime_error("snapshot truncated");
         }
+        pos += length;
+        return std::string((char const *)data + pos - length, length);
     }
-    setup.tab_stops = newstops;
 
-    std::vector<Line> newscreen;
-    for (ssize_t y = 0; y < i_rows; ++y)
+    void get_setup(VT102::Setup *setup)
     {
-        Line line{Line::NORMAL, std::vector<Char>()};
-        for (ssize_t x = 0; x < i_cols; ++x)
+        for (bool *flag :
+            {
+                &setup->online, &setup->block_cursor, &setup->margin_bell,
+                &setup->keyclick, &setup->auto_XON_XOFF,
+                &setup->UK_charset, &setup->stop_bits,
+                &setup->receive_parity, &setup->break_enable,
+                &setup->disconn_char_enable, &setup->disconn_delay,
+                &setup->auto_answerback, &setup->initial_direction,
+                &setup->auto_turnaround, &setup->power,
+                &setup->wps_terminal_kbd
+            })
         {
-            if (   y < (ssize_t)screen.size()
-                && x < (ssize_t)screen[y].chars.size())
-            {
-                line.chars.push_back(screen[y].chars[x]);
-            }
-            else
-            {
-                line.chars.push_back(
-                    (Char){' ', false, false, false, false, g[0]});
-            }
+            *flag = get<uint8_t>();
+        }
+        setup->delimiter = get<int32_t>();
+        setup->answerback_idx = get<int32_t>();
+        setup->brightness = get<double>();
+        setup->tab_stops.resize(get<uint32_t>());
+        for (size_t i = 0; i < setup->tab_stops.size(); ++i)
+        {
+            setup->tab_stops[i] = get<uint8_t>();
+        }
+        for (int *value :
+            {
+                &setup->modem.data_parity_bits, &setup->modem.tx_speed,
+                &setup->modem.rx_speed, &setup->modem.control,
+                &setup->modem.turnaround_disconn_char,
+                &setup->printer.data_parity_bits,
+                &setup->printer.tx_rx_speed
+            })
+        {
+            *value = get<int32_t>();
         }
-        newscreen.push_back(line);
     }
-    screen = newscreen;
 
-    std::vector<Line> newsaved;
-    for (ssize_t y = 0; y < i_rows; ++y)
+    void get_lines(std::vector<Row> *lines)
     {
-        Line line{Line::NORMAL, std::vector<Char>()};
-        for (ssize_t x = 0; x < i_cols; ++x)
+        lines->resize(get<uint32_t>());
+        for (Row &row : *lines)
         {
-            if (   y < (ssize_t)saved_screen.size()
-                && x < (ssize_t)saved_screen[y].chars.size())
+            std::shared_ptr<Line> line = std::make_shared<Line>();
+            row = line;
+
+            uint8_t const attr = get<uint8_t>();
+            if (attr > Line::DOUBLE_WIDTH)
             {
-                line.chars.push_back(saved_screen[y].chars[x]);
+                throw std::runtime_error("snapshot has a bad line");
             }
-            else
+            line->attr = (Line::Attr)attr;
+
+            uint32_t const length = get<uint32_t>();
+            if ((size - pos) / sizeof(Char) < length)
             {
-                line.chars.push_back(
-                    (Char){' ', false, false, false, false, g[0]});
+                throw std::runtime_error("snapshot truncated");
             }
+
+            /* check the cells before they're copied in, as a bool
+             * which isn't 0 or 1 can't even be looked at */
+            uint8_t const *cells = data + pos;
+            for (uint32_t x = 0; x < length; ++x, cells += sizeof(Char))
+            {
+                uint8_t const charset = cells[offsetof(Char, charset)];
+                if (   cells[offsetof(Char, underline)] > 1
+                    || cells[offsetof(Char, reverse)] > 1
+                    || cells[offsetof(Char, blink)] > 1
+                    || cells[offsetof(Char, bold)] > 1
+                    || charset > (uint8_t)CharSet::AltROMSpecial
+                    ||    cells[offsetof(Char, glyph)]
+                       != VT102::fontidx(
+                              (CharSet)charset,
+                              cells[offsetof(Char, ch)]))
+                {
+                    throw std::runtime_error("snapshot has a bad cell");
+                }
+            }
+
+            line->chars.resize(length);
+            memcpy(line->chars.data(), data + pos, length * sizeof(Char));
+            pos += length * sizeof(Char);
+        }
+    }
+};
+
+
+void VT102::serialize(std::string *out) const
+{
+    /* the rows of cells make up most of it */
+    out->reserve(
+        out->size() + 1024
+        + (screen.size() + saved_screen.size()) * (cols * sizeof(Char) + 5));
+
+    put<uint8_t>(out, snapshot_version);
+    put<uint8_t>(out, sizeof(Char));
+
+    put<int64_t>(out, cols);
+    put<int64_t>(out, rows);
+    put<int64_t>(out, curs_x);
+    put<int64_t>(out, curs_y);
+    put<uint8_t>(out, (uint8_t)state);
+    put<uint8_t>(out, (uint8_t)saved_state);
+    put<uint8_t>(out, (uint8_t)keypad_mode);
+    for (CharSet charset : g)
+    {
+        put<uint8_t>(out, (uint8_t)charset);
+    }
+    put<int32_t>(out, current_charset);
+    put<int32_t>(out, single_shift);
+    put<uint32_t>(out, char_attributes);
+    for (bool mode :
+        {
+            KAM, IRM, SRM, LNM, DECCKM, DECANM, DECCOLM, DECSCLM,
+            DECSCNM, DECOM, DECAWM, DECARM, DECPFF, DECPEX
+        })
+    {
+        put<uint8_t>(out, mode);
+    }
+
+    put_setup(out, setup);
+    put_setup(out, user_setup);
+    put<uint8_t>(out, modem_features_selected);
+
+    put<int32_t>(out, scroll_top);
+    put<int32_t>(out, scroll_bottom);
+    out->append(answerback, sizeof(answerback));
+    put<uint8_t>(out, xon);
+
+    /* a control sequence may be half-parsed */
+    put<uint8_t>(out, cmd != nullptr);
+    if (cmd != nullptr)
+    {
+        put<uint32_t>(out, cmd->params.size());
+        for (std::string const &param : cmd->params)
+        {
+            put_string(out, param);
+        }
+        put_string(out, cmd->intermediate);
+        put<uint8_t>(out, cmd->final);
+    }
+
+    put<uint8_t>(out, saved != nullptr);
+    if (saved != nullptr)
+    {
+        put<int64_t>(out, saved->x);
+        put<int64_t>(out, saved->y);
+        put<uint32_t>(out, saved->charattr);
+        put<int32_t>(out, saved->charset);
+        put<uint8_t>(out, saved->DECOM);
+    }
+
+    put_lines(out, screen);
+    put_lines(out, saved_screen);
+}
+
+void VT102::deserialize(uint8_t const *data, size_t size)
+{
+    SnapshotReader in{data, size, 0};
+
+    if (   in.get<uint8_t>() != snapshot_version
+        || in.get<uint8_t>() != sizeof(Char))
+    {
+        throw std::runtime_error("unsupported snapshot version");
+    }
+
+    cols = in.get<int64_t>();
+    rows = in.get<int64_t>();
+    curs_x = in.get<int64_t>();
+    curs_y = in.get<int64_t>();
+    state = (State)in.get<uint8_t>();
+    saved_state = (State)in.get<uint8_t>();
+    keypad_mode = (KPMode)in.get<uint8_t>();
+    for (CharSet &charset : g)
+    {
+        charset = (CharSet)in.get<uint8_t>();
+    }
+    current_charset = in.get<int32_t>();
+    single_shift = in.get<int32_t>();
+    char_attributes = in.get<uint32_t>();
+    for (bool *mode :
+        {
+            &KAM, &IRM, &SRM, &LNM, &DECCKM, &DECANM, &DECCOLM, &DECSCLM,
+            &DECSCNM, &DECOM, &DECAWM, &DECARM, &DECPFF, &DECPEX
+        })
+    {
+        *mode = in.get<uint8_t>();
+    }
+
+    in.get_setup(&setup);
+    in.get_setup(&user_setup);
+    modem_features_selected = in.get<uint8_t>();
+
+    scroll_top = in.get<int32_t>();
+    scroll_bottom = in.get<int32_t>();
+    for (char &ch : answerback)
+    {
+        ch = in.get<char>();
+    }
+    xon = in.get<uint8_t>();
+
+    delete cmd;
+    cmd = nullptr;
+    if (in.get<uint8_t>())
+    {
+        cmd = new ControlSequence();
+        cmd->params.resize(in.get<uint32_t>());
+        for (std::string &param : cmd->params)
+        {
+            param = in.get_string();
+        }
+        cmd->intermediate = in.get_string();
+        cmd->final = in.get<uint8_t>();
+    }
+
+    delete saved;
+    saved = nullptr;
+    if (in.get<uint8_t>())
+    {
+        saved = new SavedData{};
+        saved->x = in.get<int64_t>();
+        saved->y = in.get<int64_t>();
+        saved->charattr = in.get<uint32_t>();
+        saved->charset = in.get<int32_t>();
+        saved->DECOM = in.get<uint8_t>();
+    }
+
+    in.get_lines(&screen);
+    in.get_lines(&saved_screen);
+
+    /* the SET-UP fields index tables, the tab stops and the
+     * answerback */
+    auto const valid_setup = [this](Setup const &s)
+    {
+        return (size_t)cols == s.tab_stops.size()
+            && 0 <= s.answerback_idx && s.answerback_idx < 20
+            && 0 <= s.modem.data_parity_bits
+            && s.modem.data_parity_bits < 8
+            && 0 <= s.modem.tx_speed && s.modem.tx_speed < 16
+            && 0 <= s.modem.rx_speed && s.modem.rx_speed < 16
+            && 0 <= s.modem.control && s.modem.control < 5
+            && 0 <= s.modem.turnaround_disconn_char
+            && s.modem.turnaround_disconn_char < 5
+            && 0 <= s.printer.data_parity_bits
+            && s.printer.data_parity_bits < 8
+            && 0 <= s.printer.tx_rx_speed && s.printer.tx_rx_speed < 16;
+    };
+
+    /* make sure the terminal can't index outside the screen: the
+     * cursor's column is always on it, but putc leaves curs_y == rows
+     * while a wrap is pending, and CUP can move it as far down as a
+     * parameter goes */
+    bool valid =\
+           rows > 0 && cols > 0
+        && (ssize_t)screen.size() == rows
+        && valid_setup(setup)
+        && valid_setup(user_setup)
+        && 0 <= curs_x && curs_x < cols
+        && 0 <= curs_y && curs_y <= std::max<ssize_t>(rows, PARAM_MAX - 1)
+        && 0 <= scroll_top && scroll_top < scroll_bottom
+        && scroll_bottom < rows
+        && state <= State::CreateAnswerback
+        && saved_state <= State::CreateAnswerback
+        && 0 <= current_charset && current_charset < 4
+        && -1 <= single_shift && single_shift < 4
+        && (saved == nullptr || (0 <= saved->charset && saved->charset < 4));
+    for (CharSet charset : g)
+    {
+        valid = valid && charset <= CharSet::AltROMSpecial;
+    }
+    /* SET-UP needs the screen it was opened over */
+    bool const in_setup =\
+           state == State::SetUpA
+        || state == State::SetUpB
+        || state == State::CreateAnswerback;
+    valid = valid
+        && (saved_screen.empty() || (ssize_t)saved_screen.size() == rows)
+        && (!in_setup || !saved_screen.empty());
+    for (std::vector<Row> const *lines : { &screen, &saved_screen })
+    {
+        for (Row const &row : *lines)
+        {
+            valid = valid && (ssize_t)row->chars.size() == cols;
         }
-        newsaved.push_back(line);
     }
-    saved_screen = newsaved;
+    if (!valid)
+    {
+        throw std::runtime_error("snapshot is inconsistent");
+    }
 }
 
 
+std::vector<Scrollback::Hit> VT102::search(
+    std::string const &needle,
+    bool ignore_case,
+    size_t max_hits) const
+{
+    std::vector<Scrollback::Hit> hits;
+    scrollback.search(needle, ignore_case, max_hits, &hits);
+
+    /* the screen is small enough to just look through */
+    std::vector<uint8_t> text;
+    for (ssize_t y = 0; y < rows && hits.size() < max_hits; ++y)
+    {
+        text.clear();
+        for (Char const &chr : screen[y]->chars)
+        {
+            text.push_back(chr.ch);
+        }
+        Scrollback::find(
+            text.data(),
+            text.size(),
+            needle,
+            ignore_case,
+            scrollback.size() + y,
+            max_hits,
+            &hits);
+    }
+    return hits;
+}
 
 Char VT102::getc_at(ssize_t x, ssize_t y) const
 {
@@ -2496,145 +2913,147 @@ Char VT102::getc_at(ssize_t x, ssize_t y) const
     }
     else
     {
-        return screen[y].chars[x];
+        return screen[y]->chars[x];
     }
 }
 
-size_t VT102::fontidx(CharSet charset, unsigned char ch) const
+size_t VT102::fontidx(CharSet charset, unsigned char ch)
 {
-    size_t idx = 0;
-    switch (charset)
-    {
-    /* the only difference between the US and UK charsets are for '#',
-     * which renders as '#' in the US, and as the pound (currency)
-     * symbol in the UK */
-    case CharSet::UnitedStates:
-    case CharSet::UnitedKingdom:
-        switch (ch)
-        {
-        /* 1st and 2nd columns are control characters, so they don't
-         * render as anything, except for SUB, which draws the
-         * 'substitute character' */
-        case 0x1A:
-            idx = 16;
-            break;
-
-        case '#':
-            if (charset == CharSet::UnitedStates)
-            {
-                idx = 26;
-            }
-            else    /* UK */
-            {
-                idx = 113;
-            }
-            break;
-
-        default:
-            idx = (8 * ch) % 127;
-            break;
-        }
-        break;
-
-    case CharSet::Special:
-        switch (ch)
-        {
-        /* 1st and 2nd columns are control characters, so they don't
-         * render as anything, except for SUB, which draws the
-         * 'substitute character' */
-        case 0x1A:
-            idx = 16;
-            break;
+    return fontidx_table[(size_t)charset][ch];
+}
 
-        case '_':
-            idx = 0;
-            break;
+Line &VT102::edit_line(ssize_t y)
+{
+    /* copy the row if anyone else can see it */
+    Row &row = screen[y];
+    if (row.use_count() != 1)
+    {
+        row = std::make_shared<Line>(*row);
+    }
+    /* every row is made as a non-const Line */
+    return const_cast<Line &>(*row);
+}
 
-        /* 7th column */
-        case '`':
-        case 'a' ... 'o':
-            idx = (8 + (8 * (ch - '`'))) % 127;
-            break;
+Char VT102::blank_char(void) const
+{
+    return Char{
+        ' ', false, false, false, false, g[0],
+        (uint8_t)fontidx(g[0], ' ')};
+}
 
-        /* 8th column */
-        case 'p' ... 'z':
-        case '{':
-        case '|':
-        case '}':
-        case '~':
-            idx = (9 + (8 * (ch - 'p'))) % 127;
-            break;
+Char const *VT102::blank_cells(void)
+{
+    if (    (ssize_t)blanks.size() != cols
+        ||  (cols > 0 && blanks[0].charset != g[0]))
+    {
+        blanks.assign(cols, blank_char());
+    }
+    return blanks.data();
+}
 
-        default:
-            idx = (8 * ch) % 127;
-            break;
-        }
-        break;
+Row VT102::blank_row(void) const
+{
+    return std::make_shared<Line>(
+        Line{Line::NORMAL, std::vector<Char>(cols, blank_char())});
+}
 
-    case CharSet::AltROM:
-    case CharSet::AltROMSpecial:
-        idx = (8 * ch) % 127;
-        break;
+void VT102::erase(ssize_t x0, ssize_t x1, ssize_t y)
+{
+    x0 = std::max<ssize_t>(x0, 0);
+    x1 = std::min(x1, cols);
+    if (x0 < x1 && y >= 0 && y < rows)
+    {
+        /* Char is a POD, so this is a memcpy */
+        Char const *blank = blank_cells();
+        Line &line = edit_line(y);
+        std::copy(blank + x0, blank + x1, line.chars.begin() + x0);
     }
-    return idx;
 }
 
-void VT102::erase(ssize_t x, ssize_t y)
+void VT102::del_chars(ssize_t x, ssize_t y, ssize_t n)
 {
-    if (    x >= 0 && x < cols
-        &&  y >= 0 && y < rows)
+    n = std::min(n, cols - x);
+    if (x < 0 || n <= 0)
     {
-        Line &line = screen.at(y);
-        line.chars.at(x).ch        = ' ';
-        line.chars.at(x).underline = false;
-        line.chars.at(x).reverse   = false;
-        line.chars.at(x).blink     = false;
-        line.chars.at(x).bold      = false;
-        line.chars.at(x).charset   = g[0];
+        return;
     }
+    Line &line = edit_line(y);
+    auto const end = line.chars.begin() + cols;
+
+    /* the cells coming in at the end are blanks with the last cell's
+     * attributes: character attributes ARE NOT modified */
+    Char blank = line[cols - 1];
+    blank.ch = ' ';
+    blank.charset = g[current_charset];
+    blank.glyph = fontidx(blank.charset, ' ');
+
+    std::copy(line.chars.begin() + x + n, end, line.chars.begin() + x);
+    std::fill(end - n, end, blank);
 }
 
-void VT102::del_char(ssize_t x, ssize_t y)
+void VT102::ins_chars(ssize_t x, ssize_t y, ssize_t n)
 {
-    Line &line = screen[y];
-
-    for (ssize_t i = x; i < cols-1; ++i)
+    n = std::min(n, cols - x);
+    if (x < 0 || n <= 0)
     {
-        line[i] = line[i + 1];
+        return;
     }
-    /* character attributes ARE NOT modified */
-    line[cols-1].ch = ' ';
-    line[cols-1].charset = g[current_charset];
+    Char const *blank = blank_cells();
+    Line &line = edit_line(y);
+    auto const end = line.chars.begin() + cols;
+
+    std::copy_backward(line.chars.begin() + x, end - n, end);
+    std::copy(blank + x, blank + x + n, line.chars.begin() + x);
 }
 
-void VT102::del_line(ssize_t y)
+void VT102::del_lines(ssize_t y, ssize_t n)
 {
-    /* lines below the cursor move up */
-    for (size_t i = y; i < screen.size()-1; ++i)
+    n = std::min(n, scroll_bottom + 1 - y);
+    if (n <= 0)
     {
-        screen[i] = screen[i + 1];
+        return;
     }
-    for (Char &chr : screen[screen.size()-1].chars)
+    /* lines below the cursor move up, and the lines coming in at the
+     * bottom of the region are blank copies of the line which was
+     * there: character attributes ARE NOT modified */
+    Row const bottom = screen[scroll_bottom];
+    std::rotate(
+        screen.begin() + y,
+        screen.begin() + y + n,
+        screen.begin() + scroll_bottom + 1);
+    ssize_t const first = scroll_bottom + 1 - n;
+    screen[first] = bottom;
+    for (Char &chr : edit_line(first).chars)
     {
-        /* character attributes ARE NOT modified */
         chr.ch = ' ';
         chr.charset = g[current_charset];
+        chr.glyph = fontidx(chr.charset, ' ');
     }
+    /* the rest share the blank line until they're written to */
+    std::fill(
+        screen.begin() + first + 1,
+        screen.begin() + scroll_bottom + 1,
+        screen[first]);
 }
 
-void VT102::ins_line(ssize_t y)
+void VT102::ins_lines(ssize_t y, ssize_t n)
 {
-    /* lines below the cursor move down */
-    for (ssize_t i = screen.size()-2; i >= y; --i)
+    n = std::min(n, scroll_bottom + 1 - y);
+    if (n <= 0)
     {
-        screen[i + 1] = screen[i];
+        return;
     }
-    /* clear the inserted line */
-    for (size_t x = 0; x < screen[y].chars.size(); ++x)
+    /* lines below the cursor move down, and the lines pushed off the
+     * bottom of the region are reused as the inserted ones */
+    std::rotate(
+        screen.begin() + y,
+        screen.begin() + scroll_bottom + 1 - n,
+        screen.begin() + scroll_bottom + 1);
+    for (ssize_t i = y; i < y + n; ++i)
     {
-        erase(x, y);
+        erase(0, cols, i);
+        edit_line(i).attr = Line::NORMAL;
     }
-    screen[y].attr = Line::NORMAL;
 }
 
 void VT102::putc(unsigned char ch)
@@ -2651,17 +3070,12 @@ void VT102::putc(unsigned char ch)
          * characters 1 position to the right */
         if (IRM)
         {
-            for (ssize_t i = cols-2; i >= curs_x; --i)
-            {
-                screen[curs_y][i + 1] = screen[curs_y][i];
-            }
+            ins_chars(curs_x, curs_y, 1);
         }
 
-        /* erase the old character */
-        erase(curs_x, curs_y);
-
-        /* add the new character */
-        Char &chr = screen[curs_y][curs_x];
+        /* add the new character (every field of the old one is
+         * replaced) */
+        Char &chr = edit_line(curs_y)[curs_x];
         chr.ch = ch;
 
         /* SS2 and SS3 */
@@ -2674,6 +3088,7 @@ void VT102::putc(unsigned char ch)
         {
             chr.charset = g[current_charset];
         }
+        chr.glyph = fontidx(chr.charset, ch);
 
         chr.bold = char_attributes & BOLD;
         chr.underline = char_attributes & UNDERLINE;
@@ -2699,24 +3114,32 @@ void VT102::putc(unsigned char ch)
 void VT102::scroll(ssize_t n)
 {
     curs_y += n;
+    if (n != 0)
+    {
+        ParseStats &stats = parse_stats();
+        stats.scrolls[(n < 0)? 0 : 1].add(1);
+        ParseStats::add(stats.scroll_lines, (n < 0)? -n : n);
+    }
     /* scroll up */
     if (n < 0)
     {
         for (ssize_t i = 0; i < -n; ++i)
         {
-            for (ssize_t j = scroll_top; j < scroll_bottom; ++j)
+            /* only lines leaving the top of the screen are kept,
+             * not ones leaving a region further down */
+            if (scroll_top == 0)
             {
-                screen.at(j) = screen.at(j + 1);
-            }
-            for (Char &chr : screen[scroll_bottom].chars)
-            {
-                chr.ch = ' ';
-                chr.underline = false;
-                chr.reverse = false;
-                chr.blink = false;
-                chr.bold = false;
-                chr.charset = g[0];
+                scrollback.push(*screen[0]);
             }
+            /* the line leaving the top is reused at the bottom, with
+             * the line attribute of the one that was there */
+            Line::Attr const attr = screen[scroll_bottom]->attr;
+            std::rotate(
+                screen.begin() + scroll_top,
+                screen.begin() + scroll_top + 1,
+                screen.begin() + scroll_bottom + 1);
+            erase(0, cols, scroll_bottom);
+            edit_line(scroll_bottom).attr = attr;
         }
     }
     /* scroll down */
@@ -2724,19 +3147,13 @@ void VT102::scroll(ssize_t n)
     {
         for (ssize_t i = 0; i < n; ++i)
         {
-            for (ssize_t j = scroll_bottom-1; j >= scroll_top; --j)
-            {
-                screen[j + 1] = screen[j];
-            }
-            for (Char &chr : screen[scroll_top].chars)
-            {
-                chr.ch        = ' ';
-                chr.underline = false;
-                chr.reverse   = false;
-                chr.blink     = false;
-                chr.bold      = false;
-                chr.charset   = g[0];
-            }
+            Line::Attr const attr = screen[scroll_top]->attr;
+            std::rotate(
+                screen.begin() + scroll_top,
+                screen.begin() + scroll_bottom,
+                screen.begin() + scroll_bottom + 1);
+            erase(0, cols, scroll_top);
+            edit_line(scroll_top).attr = attr;
         }
     }
 }
@@ -2787,6 +3204,7 @@ VT102::VT102()
     curs_x(0),
     curs_y(0),
     state(State::Normal),
+    saved_state(State::Normal),
     keypad_mode(KPMode::Numeric),
     g{
         CharSet::UnitedStates,
@@ -2817,26 +3235,81 @@ VT102::VT102()
     scroll_bottom(rows-1),
     answerback(""),
     screen(),
+    saved_screen(),
+    blanks(),
+    scrollback(),
     cmd(nullptr),
     xon(true),
     outbuffer(""),
+    flow{
+        32768,
+        8192,
+        false,
+        0,
+        std::chrono::nanoseconds(0),
+        std::chrono::steady_clock::time_point()},
+    errors(),
+    printable_run(0),
     saved(nullptr)
 {
-    for (ssize_t y = 0; y < rows; ++y)
-    {
-        Line line{Line::NORMAL, std::vector<Char>()};
-        for (ssize_t x = 0; x < cols; ++x)
-        {
-            line.chars.push_back(
-                (Char){' ', false, false, false, false, g[0]});
-        }
-        screen.push_back(line);
-    }
+    screen.assign(rows, blank_row());
+    outbuffer.reserve(outbuffer_reserve);
+}
+
+VT102::VT102(const VT102 &other)
+:   cols(other.cols),
+    rows(other.rows),
+    curs_x(other.curs_x),
+    curs_y(other.curs_y),
+    state(other.state),
+    saved_state(other.saved_state),
+    keypad_mode(other.keypad_mode),
+    g{other.g[0], other.g[1], other.g[2], other.g[3]},
+    current_charset(other.current_charset),
+    single_shift(other.single_shift),
+    char_attributes(other.char_attributes),
+    KAM(other.KAM),
+    IRM(other.IRM),
+    SRM(other.SRM),
+    LNM(other.LNM),
+    DECCKM(other.DECCKM),
+    DECANM(other.DECANM),
+    DECCOLM(other.DECCOLM),
+    DECSCLM(other.DECSCLM),
+    DECSCNM(other.DECSCNM),
+    DECOM(other.DECOM),
+    DECAWM(other.DECAWM),
+    DECARM(other.DECARM),
+    DECPFF(other.DECPFF),
+    DECPEX(other.DECPEX),
+    setup(other.setup),
+    user_setup(other.user_setup),
+    modem_features_selected(other.modem_features_selected),
+    scroll_top(other.scroll_top),
+    scroll_bottom(other.scroll_bottom),
+    answerback(),
+    screen(other.screen),
+    saved_screen(other.saved_screen),
+    blanks(other.blanks),
+    scrollback(),
+    cmd((other.cmd != nullptr)? new ControlSequence(*other.cmd) : nullptr),
+    xon(other.xon),
+    outbuffer(other.outbuffer),
+    flow(other.flow),
+    errors(),
+    printable_run(other.printable_run),
+    saved((other.saved != nullptr)? new SavedData(*other.saved) : nullptr)
+{
+    memcpy(answerback, other.answerback, sizeof(answerback));
+    memcpy(errors, other.errors, sizeof(errors));
+    scrollback.set_capacity(other.scrollback.capacity());
+    outbuffer.reserve(outbuffer_reserve);
 }
 
 VT102::~VT102()
 {
     delete cmd;
+    delete saved;
 }
 
 
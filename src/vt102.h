@@ -9,11 +9,18 @@
 #ifndef _VT102_H
 #define _VT102_H
 
+#include "scrollback.h"
+
 #include <string>
+#include <string_view>
 #include <vector>
 #include <array>
+#include <chrono>
+#include <memory>
+#include <type_traits>
 
-extern bool VT102CONFIG_do_trace;
+/* describe errors in the host's output on stderr as they happen */
+extern bool VT102CONFIG_report_errors;
 
 
 struct ControlSequence
@@ -35,7 +42,7 @@ struct ControlSequence
 };
 
 
-enum class CharSet
+enum class CharSet : uint8_t
 {
     UnitedStates,
     UnitedKingdom,
@@ -53,12 +60,18 @@ struct Char
          blink,
          bold;
     CharSet charset;
+    /* font index of ch in charset, resolved when the cell is written */
+    uint8_t glyph;
 };
+/* rows of cells are saved in snapshots as they are in memory */
+static_assert(
+    std::is_trivially_copyable<Char>::value && sizeof(Char) == 7,
+    "Char must be a padding-free POD");
 
 
 struct Line
 {
-    enum
+    enum Attr
     {
         NORMAL,
         DOUBLE_HEIGHT_UPPER,
@@ -78,6 +91,11 @@ struct Line
     }
 };
 
+/* rows are shared between the screen and copies of it (SET-UP's saved
+ * screen, copies of the terminal), and only copied once they're
+ * written to; see VT102::edit_line */
+typedef std::shared_ptr<Line const> Row;
+
 
 class VT102
 {
@@ -174,6 +192,7 @@ public:
         KP_0,
         KP_Period,
     };
+    static size_t const keys = KP_Period + 1;
     enum Modifiers
     {
         None     = 0,
@@ -285,13 +304,55 @@ public:
 
     char answerback[20];
 
-    std::vector<Line> screen,
-                      saved_screen;
+    std::vector<Row> screen,
+                     /* the screen under SET-UP, empty otherwise */
+                     saved_screen;
+    /* a row's worth of blank cells, copied over whatever is erased;
+     * see blank_cells */
+    std::vector<Char> blanks;
+    /* lines scrolled off the top of the screen */
+    Scrollback scrollback;
 
     ControlSequence *cmd;
 
     bool xon;
+    /* bytes for the host, the writer erases what it has sent; space is
+     * reserved up front so typing doesn't allocate */
     std::string outbuffer;
+    static size_t const outbuffer_reserve = 4096;
+
+    /* automatic XON/XOFF: when auto_XON_XOFF is set, XOFF is sent once
+     * the unparsed input reaches xoff_threshold bytes, and XON once it
+     * falls to xon_threshold bytes */
+    struct FlowControl
+    {
+        size_t xoff_threshold,
+               xon_threshold;
+        bool xoff_sent;
+
+        unsigned long long xoff_episodes;
+        std::chrono::nanoseconds xoff_time;
+        std::chrono::steady_clock::time_point xoff_since;
+    } flow;
+
+    /* what was wrong with a byte from the host; whatever it was is
+     * ignored, as a real VT102 ignores it */
+    enum class Error
+    {
+        None,
+        UnknownEscape,
+        UnknownControlSequence,
+        UnknownParameter,   /* undefined mode, SGR attribute, ... */
+        BadParameters,      /* too many of them, or not numbers */
+        Unimplemented,      /* ETX, EOT, RIS, DECTST, VT52 mode */
+    };
+    static size_t const error_kinds = (size_t)Error::Unimplemented + 1;
+    /* how many errors of each kind there have been */
+    unsigned long long errors[error_kinds];
+
+    /* printable bytes since the last byte which wasn't, for the
+     * printable_run statistic (see parsestats.h) */
+    size_t printable_run;
 
 
     struct SavedData
@@ -304,44 +365,114 @@ public:
     } *saved;
 
 
-    void output(std::string message);
+    /* send message to the host, and echo it when SRM is off (the echo
+     * isn't counted in the parse statistics) */
+    void output(std::string_view message);
+    /* send XON/XOFF for the given amount of unparsed input,
+     * returns true if anything was sent */
+    bool flow_control(size_t backlog);
     void keyboard_input(Key key, unsigned int mod);
 
-    void interpret_byte(uint8_t ch);
-    void interpret_byte_control_character(uint8_t ch);
-    void interpret_byte_escape(uint8_t ch);
-    void interpret_byte_ctrlseq(uint8_t ch);
+    /* interpret a byte from the host, returning what was wrong with
+     * it, if anything */
+    Error interpret_byte(uint8_t ch);
+    /* interpret a run of bytes from the host, counting them in the
+     * thread's parse statistics (see parsestats.h) */
+    void interpret_bytes(uint8_t const *bytes, size_t size);
+    Error interpret_byte_control_character(uint8_t ch);
+    Error interpret_byte_escape(uint8_t ch);
+    Error interpret_byte_ctrlseq(uint8_t ch);
+    /* count an error (and report it, if errors are being reported),
+     * ch is the byte which caused it */
+    Error error(Error kind, char const *what, uint8_t ch);
+    static char const *error_name(Error kind);
 
     void enter_setup(void);
+    /* draw all of SET-UP, keys redraw just the fields they change */
     void display_setup(void);
+    void display_setup_page(void);
+    void display_setup_tab_stops(void);
+    void display_setup_tab_stop(ssize_t x);
+    void display_setup_modem(void);
+    void display_setup_printer(void);
+    void display_setup_switches(void);
+    void display_setup_switch(ssize_t x);
+    void display_setup_answerback(void);
+    /* the feature set by SET-UP B's switch in column x, or nullptr */
+    bool *setup_switch(ssize_t x);
+    /* write SET-UP's text straight into the cells at x,y */
+    void setup_text(
+        ssize_t x,
+        ssize_t y,
+        std::string const &text,
+        unsigned attributes,
+        CharSet charset=CharSet::UnitedStates);
     void exit_setup(void);
 
-    char getkey(Key key, unsigned int mod) const;
+    /* the character key types with the given modifiers,
+     * or -1 if it doesn't type one */
+    int getkey(Key key, unsigned int mod) const;
     void resize(ssize_t cols, ssize_t rows);
 
+    /* approximate memory used by the terminal, in bytes */
+    size_t memory_usage(void) const;
 
-    /* get the character at the given x,y coords */
-    Char getc_at(ssize_t x, ssize_t y) const;
-
-    /* get the font index of ch in the given charset */
-    size_t fontidx(CharSet charset, unsigned char ch) const;
+    /* save the terminal's state (not the scrollback) to out, or
+     * restore it from a saved copy, throwing std::runtime_error if
+     * it's malformed (which leaves the terminal half restored);
+     * snapshots are in host byte order, the rows of cells are copied
+     * straight out of and into memory */
+    static uint8_t const snapshot_version = 2;
+    void serialize(std::string *out) const;
+    void deserialize(uint8_t const *data, size_t size);
 
-    /* erase the character at the given position */
-    void erase(ssize_t x, ssize_t y);
+    /* find the first max_hits occurrences of needle, oldest first;
+     * lines are numbered through the scrollback and then the screen,
+     * so screen row y is line scrollback.size() + y */
+    std::vector<Scrollback::Hit> search(
+        std::string const &needle,
+        bool ignore_case=false,
+        size_t max_hits=1000) const;
 
-    /* delete the character at the given position
-     * (moves everything on the given line left by one position) */
-    void del_char(ssize_t x, ssize_t y);
 
-    /* insert a blank character at the given position
-     * (moves everything on the given line right by one position) */
-    void ins_char(ssize_t x, ssize_t y);
-
-    /* delete given line */
-    void del_line(ssize_t y);
+    /* get the character at the given x,y coords */
+    Char getc_at(ssize_t x, ssize_t y) const;
 
-    /* insert a new blank line at the given position */
-    void ins_line(ssize_t y);
+    /* get the font index of ch in the given charset */
+    static size_t fontidx(CharSet charset, unsigned char ch);
+
+    /* row y of the screen, ready to be written to */
+    Line &edit_line(ssize_t y);
+    /* a blank cell, as left behind by erasing */
+    Char blank_char(void) const;
+    /* cols blank cells, rebuilt if the screen or G0 has changed */
+    Char const *blank_cells(void);
+    /* a new blank row, which can be shared by any number of lines */
+    Row blank_row(void) const;
+    /* fit lines to the screen size */
+    void resize_rows(std::vector<Row> *lines) const;
+
+    /* erase the characters from x0 up to (not including) x1 on row y,
+     * anything outside the screen is left alone */
+    void erase(ssize_t x0, ssize_t x1, ssize_t y);
+
+    /* delete n characters at the given position
+     * (moves the rest of the line left by n positions) */
+    void del_chars(ssize_t x, ssize_t y, ssize_t n);
+
+    /* insert n blank characters at the given position
+     * (moves the rest of the line right by n positions, the characters
+     * pushed off the end are lost) */
+    void ins_chars(ssize_t x, ssize_t y, ssize_t n);
+
+    /* delete n lines at y, which must be in the scrolling region
+     * (the lines below it in the region move up) */
+    void del_lines(ssize_t y, ssize_t n);
+
+    /* insert n blank lines at y, which must be in the scrolling region
+     * (the lines below it in the region move down, the lines pushed
+     * past the bottom of the region are lost) */
+    void ins_lines(ssize_t y, ssize_t n);
 
     /* write a character at the cursor position */
     void putc(unsigned char ch);
@@ -353,7 +484,10 @@ public:
     void move_curs(ssize_t x, ssize_t y);
 
     VT102();
+    /* copies everything but the scrollback, which starts out empty;
+     * the rows are shared until either terminal writes to them */
     VT102(const VT102 &other);
+    VT102 &operator=(const VT102 &other) = delete;
     ~VT102();
 };
 
@@ -0,0 +1,173 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * workpool.cpp
+ *
+ *  Work-stealing thread pool
+ *
+ */
+
+#include "workpool.h"
+
+
+/* the pool and worker index of the calling thread, if it's a worker */
+static thread_local WorkPool const *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+
+
+bool WorkPool::pop(size_t self, Task *task)
+{
+    /* own queue first, oldest task first */
+    {
+        Worker &worker = *workers[self];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if (!worker.tasks.empty())
+        {
+            *task = worker.tasks.front();
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+
+    /* steal the newest task from someone else */
+    for (size_t i = 1; i < workers.size(); ++i)
+    {
+        Worker &victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            *task = victim.tasks.back();
+            victim.tasks.pop_back();
+            workers[self]->tasks_stolen.fetch_add(
+                1,
+                std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkPool::work(size_t self)
+{
+    current_pool = this;
+    current_worker = self;
+
+    for (;;)
+    {
+        Task task;
+        if (pop(self, &task))
+        {
+            queued.fetch_sub(1);
+            task.run(task.arg);
+            workers[self]->tasks_run.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idle_lock);
+        idle.wait(guard, [this]{ return stopping || queued.load() != 0; });
+        if (stopping && queued.load() == 0)
+        {
+            break;
+        }
+    }
+}
+
+void WorkPool::submit(TaskFunc run, void *arg, bool urgent)
+{
+    /* workers keep the tasks they make for themselves,
+     * everyone else's are dealt out in turn */
+    size_t idx = (current_pool == this)
+        ? current_worker
+        : next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+
+    {
+        Worker &worker = *workers[idx];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        /* counted before it can be popped, so a worker which runs it
+         * straight away can't take queued below zero */
+        queued.fetch_add(1);
+        if (urgent)
+        {
+            worker.tasks.push_front(Task{run, arg});
+        }
+        else
+        {
+            worker.tasks.push_back(Task{run, arg});
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(idle_lock);
+    idle.notify_one();
+}
+
+size_t WorkPool::size(void) const
+{
+    return workers.size();
+}
+
+unsigned long long WorkPool::tasks_run(void) const
+{
+    unsigned long long total = 0;
+    for (std::unique_ptr<Worker> const &worker : workers)
+    {
+        total += worker->tasks_run.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+unsigned long long WorkPool::tasks_stolen(void) const
+{
+    unsigned long long total = 0;
+    for (std::unique_ptr<Worker> const &worker : workers)
+    {
+        total += worker->tasks_stolen.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void WorkPool::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+        idle.notify_all();
+    }
+    for (std::unique_ptr<Worker> const &worker : workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
+
+
+WorkPool::WorkPool(size_t threads)
+:   workers(),
+    queued(0),
+    next(0),
+    idle_lock(),
+    idle(),
+    stopping(false)
+{
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back(new Worker{});
+    }
+    /* only start the threads once every queue exists */
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers[i]->thread = std::thread(&WorkPool::work, this, i);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    stop();
+}
+
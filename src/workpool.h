@@ -0,0 +1,86 @@
+/* Copyright (C) 2020 Trevor Last
+ * See LICENSE file for copyright and license details.
+ * workpool.h
+ *
+ *  Work-stealing thread pool.
+ *  Each worker runs tasks from its own queue, and steals from the
+ *  other workers' queues when its own is empty.
+ *
+ */
+
+#ifndef _WORKPOOL_H
+#define _WORKPOOL_H
+
+
+#include <cstddef>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class WorkPool
+{
+public:
+    typedef void (*TaskFunc)(void *);
+
+    struct Task
+    {
+        TaskFunc run;
+        void *arg;
+    };
+
+private:
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        std::thread thread;
+
+        std::atomic<unsigned long long> tasks_run,
+                                        tasks_stolen;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /* tasks queued, but not yet started */
+    std::atomic<size_t> queued;
+    /* where the next task from outside the pool goes */
+    std::atomic<size_t> next;
+
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    bool stopping;
+
+    /* take a task from worker self's queue, or steal one */
+    bool pop(size_t self, Task *task);
+    void work(size_t self);
+
+public:
+    /* queue run(arg) to be run by one of the workers,
+     * urgent tasks go ahead of everything already queued */
+    void submit(TaskFunc run, void *arg, bool urgent=false);
+
+    /* number of worker threads */
+    size_t size(void) const;
+
+    /* total tasks run/stolen so far */
+    unsigned long long tasks_run(void) const;
+    unsigned long long tasks_stolen(void) const;
+
+    /* run what's queued, then stop and join the workers;
+     * nothing may be submitted after this */
+    void stop(void);
+
+
+    WorkPool(size_t threads);
+    ~WorkPool();
+};
+
+
+#endif
+